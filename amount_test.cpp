@@ -0,0 +1,115 @@
+// Checks for the integer-cent amount paths.
+//
+// ExpenseStore::sumAmounts has an AVX2 gather kernel and a scalar loop, so
+// build and run this both ways; each build compares the kernel against a
+// plain sum kept alongside the generated ledger.
+//
+//   g++ -std=c++17 -O2 -pthread -o amount_test amount_test.cpp && ./amount_test
+//   g++ -std=c++17 -O2 -pthread -mavx2 -o amount_test amount_test.cpp && ./amount_test
+
+#define EXPENSE_TRACKER_NO_MAIN
+#include "final.cpp"
+
+#include <random>
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cout << "FAIL " << what << "\n";
+        failures++;
+    }
+}
+
+// Ledgers of the given size with every seventh row tombstoned. Sizes around
+// multiples of four and of 4096 exercise the kernel's lane remainder and
+// column chunk edges.
+static void checkSumAmounts(size_t rows, std::mt19937_64& random) {
+    ExpenseStore store;
+    std::vector<int64_t> amounts(rows);
+    std::uniform_int_distribution<int64_t> amountPick(-500000, 5000000);
+    uint32_t category = CategoryDictionary::global().intern("Test");
+    for (size_t i = 0; i < rows; ++i) {
+        amounts[i] = amountPick(random);
+        uint32_t date = Date(1 + static_cast<int>(i % 28), 1 + static_cast<int>(i / 28 % 12), 2024).toPacked();
+        store.append(static_cast<int>(i + 1), amounts[i], date, category, "row " + std::to_string(i));
+    }
+    for (size_t i = 0; i < rows; i += 7) {
+        store.erase(store.findSlot(static_cast<int>(i + 1)));
+    }
+
+    std::vector<size_t> slots;
+    std::vector<int64_t> expected;  // Prefix sums over the live rows
+    expected.push_back(0);
+    for (size_t slot = 0; slot < store.slotCount(); ++slot) {
+        if (!store.isLive(slot)) continue;
+        slots.push_back(slot);
+        expected.push_back(expected.back() + amounts[store.id(slot) - 1]);
+    }
+
+    const std::string label = "sumAmounts over " + std::to_string(rows) + " rows";
+    check(store.sumAmounts(slots.data(), slots.size()) == expected.back(), label);
+    for (size_t n : {size_t(0), size_t(1), size_t(3), size_t(4), size_t(5), slots.size() / 2}) {
+        if (n > slots.size()) continue;
+        check(store.sumAmounts(slots.data(), n) == expected[n],
+              label + ", first " + std::to_string(n) + " slots");
+        check(store.sumAmounts(slots.data() + slots.size() - n, n) == expected.back() - expected[slots.size() - n],
+              label + ", last " + std::to_string(n) + " slots");
+    }
+}
+
+static void checkParse(const std::string& text, bool ok, int64_t cents) {
+    int64_t parsed = 0;
+    bool result = Money::parse(text, parsed);
+    check(result == ok && (!ok || parsed == cents), "Money::parse(\"" + text + "\")");
+}
+
+static void checkFormat(int64_t cents, const std::string& text) {
+    check(Money::format(cents) == text, "Money::format(" + std::to_string(cents) + ")");
+    checkParse(text, true, cents);  // Formatted amounts parse back unchanged
+}
+
+int main() {
+    std::mt19937_64 random(42);
+    for (size_t rows : {0, 1, 3, 4, 5, 7, 8, 9, 4095, 4096, 4097, 8193}) {
+        checkSumAmounts(rows, random);
+    }
+
+    checkParse("12", true, 1200);
+    checkParse("12.5", true, 1250);
+    checkParse(".5", true, 50);
+    checkParse("-.5", true, -50);
+    checkParse("0.005", true, 1);
+    checkParse("0.004", true, 0);
+    checkParse("-0.005", true, -1);
+    checkParse("0.125", true, 13);
+    checkParse("0.1249", true, 12);
+    checkParse("-2.675", true, -268);
+    checkParse("9.995", true, 1000);
+    checkParse("1.23456789", true, 123);
+    checkParse("+7.10", true, 710);
+    checkParse("1e2", true, 10000);
+    checkParse("", false, 0);
+    checkParse("-", false, 0);
+    checkParse(".", false, 0);
+    checkParse("abc", false, 0);
+
+    checkFormat(0, "0.00");
+    checkFormat(5, "0.05");
+    checkFormat(-5, "-0.05");
+    checkFormat(-150, "-1.50");
+    checkFormat(123456789, "1234567.89");
+    checkFormat(-123456789, "-1234567.89");
+
+#ifdef __AVX2__
+    const char* build = "AVX2";
+#else
+    const char* build = "scalar";
+#endif
+    if (failures != 0) {
+        std::cout << failures << " amount check(s) failed (" << build << " build)\n";
+        return 1;
+    }
+    std::cout << "All amount checks passed (" << build << " build)\n";
+    return 0;
+}
@@ -0,0 +1,389 @@
+// Benchmark driver for the expense tracker.
+//
+// Generates synthetic ledgers, times the tracker's main operations on them
+// and writes the results as JSON so runs can be compared across versions.
+//
+//   g++ -std=c++17 -O2 -pthread -o expense_benchmark benchmark.cpp
+//   ./expense_benchmark [--rows 1000,100000] [--samples 200] [--seed 42]
+//                       [--dir DIR] [--out benchmark_results.json]
+
+#define EXPENSE_TRACKER_NO_MAIN
+#include "final.cpp"
+
+#include <memory>
+#include <random>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+// Writes ledgers that look like real ones: a handful of categories take
+// most of the spending, dates span several years, and some descriptions
+// need CSV quoting.
+class LedgerGenerator {
+private:
+    std::mt19937_64 random;
+    std::discrete_distribution<size_t> categoryPick;
+    std::lognormal_distribution<double> amountPick;
+    
+    static const std::vector<std::string>& categoryNames() {
+        static const std::vector<std::string> names = {
+            "Food", "Transport", "Bills", "Shopping", "Groceries", "Entertainment",
+            "Healthcare", "Rent", "Utilities", "Education", "Travel", "Insurance",
+            "Fitness", "Subscriptions", "Gifts", "Pets"
+        };
+        return names;
+    }
+    
+    static std::vector<double> zipfWeights(size_t count) {
+        std::vector<double> weights;
+        for (size_t rank = 1; rank <= count; ++rank) {
+            weights.push_back(1.0 / std::pow(static_cast<double>(rank), 1.1));
+        }
+        return weights;
+    }
+
+public:
+    static const std::vector<std::string>& descriptionWords() {
+        static const std::vector<std::string> words = {
+            "Lunch", "Dinner", "Coffee", "Taxi", "Bus", "Train", "Electricity", "Water",
+            "Internet", "Streaming", "Books", "Course", "Doctor", "Pharmacy", "Gym",
+            "Hotel", "Flight", "Movie", "Concert", "Shoes", "Jacket", "Present", "Vet",
+            "Premium", "Fuel", "Parking", "Snacks", "Market", "Phone", "Haircut"
+        };
+        return words;
+    }
+    
+    explicit LedgerGenerator(uint64_t seed) : random(seed), amountPick(3.0, 1.0) {
+        std::vector<double> weights = zipfWeights(categoryNames().size());
+        categoryPick = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+    }
+    
+    // Write rows expenses to path. Ids start at firstId; withIds selects the
+    // current Id,Date,... layout over the legacy one used by imports.
+    bool write(const std::string& path, size_t rows, int firstId, bool withIds) {
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) return false;
+        
+        const std::vector<std::string>& categories = categoryNames();
+        const std::vector<std::string>& words = descriptionWords();
+        std::uniform_int_distribution<int> dayPick(1, 28), monthPick(1, 12), yearPick(2015, 2024);
+        std::uniform_int_distribution<size_t> wordPick(0, words.size() - 1);
+        std::uniform_int_distribution<int> percent(0, 99);
+        
+        file << (withIds ? "Id,Date,Category,Description,Amount\n" : "Date,Category,Description,Amount\n");
+        std::string row;
+        for (size_t i = 0; i < rows; ++i) {
+            row.clear();
+            if (withIds) {
+                row += std::to_string(firstId + static_cast<int>(i));
+                row += ',';
+            }
+            
+            char date[16];
+            std::snprintf(date, sizeof(date), "%02d-%02d-%04d", dayPick(random), monthPick(random), yearPick(random));
+            row += date;
+            row += ',';
+            row += categories[categoryPick(random)];
+            row += ',';
+            
+            std::string description = words[wordPick(random)] + " " + words[wordPick(random)] +
+                                      " " + std::to_string(i % 997);
+            int style = percent(random);
+            if (style < 10) {
+                row += "\"" + words[wordPick(random)] + ", " + description + "\"";
+            } else if (style < 11) {
+                row += "\"" + description + " \"\"special\"\"\"";
+            } else {
+                row += description;
+            }
+            
+            int64_t cents = std::llround(std::min(amountPick(random), 50000.0) * 100) + 1;
+            row += ',';
+            row += Money::format(cents);
+            row += '\n';
+            file << row;
+        }
+        return static_cast<bool>(file);
+    }
+};
+
+// Sorts the samples and reports latency percentiles and throughput
+struct TimingSummary {
+    std::string name;
+    size_t samples = 0;
+    size_t itemsPerSample = 1;  // Rows touched per sample, for throughput
+    double meanMicros = 0, p50 = 0, p90 = 0, p99 = 0, maxMicros = 0;
+    double itemsPerSecond = 0;
+    
+    static TimingSummary of(const std::string& name, std::vector<double> micros, size_t itemsPerSample) {
+        TimingSummary summary;
+        summary.name = name;
+        summary.samples = micros.size();
+        summary.itemsPerSample = itemsPerSample;
+        if (micros.empty()) return summary;
+        
+        std::sort(micros.begin(), micros.end());
+        double total = 0;
+        for (double value : micros) total += value;
+        summary.meanMicros = total / micros.size();
+        summary.p50 = percentile(micros, 0.50);
+        summary.p90 = percentile(micros, 0.90);
+        summary.p99 = percentile(micros, 0.99);
+        summary.maxMicros = micros.back();
+        if (total > 0) summary.itemsPerSecond = micros.size() * itemsPerSample / (total / 1e6);
+        return summary;
+    }
+    
+    // Nearest-rank percentile of sorted values
+    static double percentile(const std::vector<double>& sorted, double fraction) {
+        size_t rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+        return sorted[rank == 0 ? 0 : rank - 1];
+    }
+};
+
+// Swallows the tracker's console output while operations are timed
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+class ExpenseTrackerBenchmark {
+private:
+    std::string directory;
+    size_t samples;
+    LedgerGenerator generator;
+    std::mt19937_64 random;
+    NullBuffer nullBuffer;
+    
+    using Clock = std::chrono::steady_clock;
+    
+    static double microsSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    }
+    
+    std::string path(const std::string& name) const {
+        return (std::filesystem::path(directory) / name).string();
+    }
+    
+    static void removeSidecars(const std::string& csv) {
+        std::remove((csv + ".journal").c_str());
+        std::remove((csv + ".manifest").c_str());
+        ExpenseTracker::removeStalePartitionFiles(csv, {});
+    }
+    
+    static void copyLedger(const std::string& from, const std::string& to) {
+        removeSidecars(to);
+        std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing);
+    }
+    
+    // Time fn once per sample with console output discarded
+    template <typename Fn>
+    std::vector<double> timeEach(size_t count, Fn fn) {
+        std::vector<double> micros;
+        micros.reserve(count);
+        std::streambuf* console = std::cout.rdbuf(&nullBuffer);
+        for (size_t i = 0; i < count; ++i) {
+            Clock::time_point start = Clock::now();
+            fn(i);
+            micros.push_back(microsSince(start));
+        }
+        std::cout.rdbuf(console);
+        return micros;
+    }
+    
+    std::vector<int> sampleIds(ExpenseTracker& tracker, size_t count) {
+        std::vector<int> ids;
+        for (size_t slot = 0; slot < tracker.expenses.slotCount(); ++slot) {
+            if (tracker.expenses.isLive(slot)) ids.push_back(tracker.expenses.id(slot));
+        }
+        std::shuffle(ids.begin(), ids.end(), random);
+        if (ids.size() > count) ids.resize(count);
+        return ids;
+    }
+
+public:
+    ExpenseTrackerBenchmark(const std::string& dir, size_t sampleCount, uint64_t seed)
+        : directory(dir), samples(sampleCount), generator(seed), random(seed + 1) {}
+    
+    std::vector<TimingSummary> run(size_t rows) {
+        std::vector<TimingSummary> results;
+        std::string base = path("ledger_base.csv");
+        std::string work = path("ledger.csv");
+        std::string import = path("ledger_import.csv");
+        size_t importRows = std::max<size_t>(rows / 10, 1);
+        size_t loadRuns = rows >= 10000000 ? 1 : 5;
+        
+        std::cerr << "Generating " << rows << " rows...\n";
+        Clock::time_point start = Clock::now();
+        if (!generator.write(base, rows, 1, true) ||
+            !generator.write(import, importRows, 0, false)) {
+            throw std::runtime_error("Could not write ledgers under " + directory);
+        }
+        results.push_back(TimingSummary::of("generate", {microsSince(start)}, rows + importRows));
+        
+        std::cerr << "Timing load and save...\n";
+        results.push_back(TimingSummary::of("loadFromCSV", timeEach(loadRuns, [&](size_t) {
+            copyLedger(base, work);
+            ExpenseTracker tracker(work);
+        }), rows));
+        
+        // The CSV load above leaves snapshot partitions behind for this one;
+        // only the newest year is loaded
+        results.push_back(TimingSummary::of("loadSnapshot", timeEach(loadRuns, [&](size_t) {
+            ExpenseTracker tracker(work);
+        }), rows));
+        
+        std::unique_ptr<ExpenseTracker> tracker;
+        timeEach(1, [&](size_t) { tracker.reset(new ExpenseTracker(work)); });
+        results.push_back(TimingSummary::of("saveToCSV", timeEach(loadRuns, [&](size_t) {
+            tracker->saveToCSV();
+        }), rows));
+        
+        std::cerr << "Timing queries...\n";
+        const std::vector<std::string>& words = LedgerGenerator::descriptionWords();
+        results.push_back(TimingSummary::of("searchExpenses", timeEach(samples, [&](size_t i) {
+            // Mostly single words, with some category names, substrings and misses
+            static const char* const extras[] = {"Food", "ark", "special", "zzzz"};
+            std::string keyword = i % 5 == 4 ? extras[(i / 5) % 4] : words[i % words.size()];
+            tracker->searchExpenses(keyword);
+        }), 1));
+        
+        results.push_back(TimingSummary::of("viewMonthlyReport", timeEach(samples, [&](size_t i) {
+            tracker->viewMonthlyReport(static_cast<int>(i % 12) + 1, 2015 + static_cast<int>(i % 10));
+        }), 1));
+        
+        results.push_back(TimingSummary::of("getTopCategories", timeEach(samples, [&](size_t) {
+            tracker->getTopCategories();
+        }), 1));
+        
+        std::cerr << "Timing edits and removals...\n";
+        std::vector<int> ids = sampleIds(*tracker, samples * 2);
+        size_t edits = ids.size() / 2;
+        
+        // editExpenseById prompts on std::cin, so script its answers
+        std::stringstream answers;
+        for (size_t i = 0; i < edits; ++i) {
+            answers << "12.34\nEdited\nEdited by benchmark " << i << "\n";
+        }
+        std::streambuf* keyboard = std::cin.rdbuf(answers.rdbuf());
+        results.push_back(TimingSummary::of("editExpenseById", timeEach(edits, [&](size_t i) {
+            tracker->editExpenseById(ids[i]);
+        }), 1));
+        std::cin.rdbuf(keyboard);
+        
+        results.push_back(TimingSummary::of("removeExpenseById", timeEach(ids.size() - edits, [&](size_t i) {
+            tracker->removeExpenseById(ids[edits + i]);
+        }), 1));
+        timeEach(1, [&](size_t) { tracker.reset(); });
+        
+        // Each import starts from a freshly loaded copy of the base ledger
+        std::cerr << "Timing import...\n";
+        std::vector<double> importMicros;
+        for (size_t i = 0; i < loadRuns; ++i) {
+            copyLedger(base, work);
+            timeEach(1, [&](size_t) { tracker.reset(new ExpenseTracker(work)); });
+            importMicros.push_back(timeEach(1, [&](size_t) { tracker->importFromCSV(import); })[0]);
+            timeEach(1, [&](size_t) { tracker.reset(); });
+        }
+        results.push_back(TimingSummary::of("importFromCSV", importMicros, importRows));
+        
+        removeSidecars(work);
+        std::remove(work.c_str());
+        std::remove(base.c_str());
+        std::remove(import.c_str());
+        return results;
+    }
+};
+
+// Largest resident set size so far, in kilobytes, or -1 if unavailable
+long peakResidentKilobytes() {
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;  // Reported in bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+void writeSummaryJSON(std::ostream& out, const TimingSummary& summary) {
+    out << std::fixed << std::setprecision(3)
+        << "{\"name\":\"" << summary.name << "\",\"samples\":" << summary.samples
+        << ",\"items_per_sample\":" << summary.itemsPerSample
+        << ",\"mean_us\":" << summary.meanMicros << ",\"p50_us\":" << summary.p50
+        << ",\"p90_us\":" << summary.p90 << ",\"p99_us\":" << summary.p99
+        << ",\"max_us\":" << summary.maxMicros << ",\"items_per_second\":" << summary.itemsPerSecond << "}";
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<size_t> rowCounts = {1000, 100000};
+    size_t samples = 200;
+    uint64_t seed = 42;
+    std::string directory = std::filesystem::temp_directory_path().string();
+    std::string outFile = "benchmark_results.json";
+    
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        std::string value = argv[i + 1];
+        if (option == "--rows") {
+            rowCounts.clear();
+            std::stringstream list(value);
+            std::string item;
+            while (getline(list, item, ',')) rowCounts.push_back(std::stoull(item));
+        } else if (option == "--samples") {
+            samples = std::stoull(value);
+        } else if (option == "--seed") {
+            seed = std::stoull(value);
+        } else if (option == "--dir") {
+            directory = value;
+        } else if (option == "--out") {
+            outFile = value;
+        } else {
+            std::cerr << "Unknown option " << option << "\n";
+            return 1;
+        }
+    }
+    
+    std::ofstream out(outFile);
+    if (!out.is_open()) {
+        std::cerr << "Error: Could not write '" << outFile << "'\n";
+        return 1;
+    }
+    
+    ExpenseTrackerBenchmark benchmark(directory, samples, seed);
+    out << "{\"seed\":" << seed << ",\"samples\":" << samples << ",\"runs\":[";
+    for (size_t run = 0; run < rowCounts.size(); ++run) {
+        std::vector<TimingSummary> results;
+        try {
+            results = benchmark.run(rowCounts[run]);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        
+        long peakKilobytes = peakResidentKilobytes();
+        out << (run ? "," : "") << "\n{\"rows\":" << rowCounts[run]
+            << ",\"peak_rss_kb\":" << peakKilobytes << ",\"operations\":[";
+        std::cout << "\n" << rowCounts[run] << " rows (peak RSS " << peakKilobytes << " KB)\n";
+        std::cout << std::left << std::setw(20) << "operation" << std::right << std::setw(12) << "p50 us"
+                  << std::setw(12) << "p99 us" << std::setw(16) << "items/s" << "\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            out << (i ? "," : "") << "\n  ";
+            writeSummaryJSON(out, results[i]);
+            std::cout << std::left << std::setw(20) << results[i].name << std::right << std::fixed
+                      << std::setprecision(1) << std::setw(12) << results[i].p50
+                      << std::setw(12) << results[i].p99 << std::setw(16) << std::setprecision(0)
+                      << results[i].itemsPerSecond << "\n";
+        }
+        out << "]}";
+    }
+    out << "\n]}\n";
+    std::cout << "\nWrote " << outFile << "\n";
+    return 0;
+}
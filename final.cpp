@@ -9,6 +9,46 @@
 #include <sstream>
 #include <ctime>
 #include <limits>
+#include <cstdio>
+#include <cstdint>
+#include <iterator>
+#include <cstring>
+#include <string_view>
+#include <charconv>
+#include <thread>
+#include <cstddef>
+#include <filesystem>
+#include <deque>
+#include <unordered_map>
+#include <cmath>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <csignal>
+#include <cerrno>
+#include <new>
+#include <cstdlib>
+#include <memory>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#define EXPENSE_TRACKER_HAS_MMAP 1
+#define EXPENSE_TRACKER_HAS_UNIX_SOCKETS 1
+#define EXPENSE_TRACKER_HAS_FILE_LOCKS 1
+#endif
 
 class Date {
 private:
@@ -45,6 +85,15 @@ public:
         return Date(parts[0], parts[1], parts[2]);
     }
     
+    // Sortable single-integer form: year in the high bits, then month and day
+    uint32_t toPacked() const {
+        return (static_cast<uint32_t>(year) << 9) | (static_cast<uint32_t>(month) << 5) | static_cast<uint32_t>(day);
+    }
+    
+    static Date fromPacked(uint32_t packed) {
+        return Date(packed & 31, (packed >> 5) & 15, static_cast<int>(packed >> 9));
+    }
+    
     bool operator<(const Date& other) const {
         if (year != other.year) return year < other.year;
         if (month != other.month) return month < other.month;
@@ -60,47 +109,410 @@ public:
     int getYear() const { return year; }
 };
 
+// Amounts are held as integer cents so totals are exact and do not depend
+// on the order rows are summed in.
+struct Money {
+    // Parse a decimal such as "12", "-3.5" or "0.125" into cents, rounding
+    // half away from zero past the second decimal. Returns false on junk.
+    static bool parse(std::string_view text, int64_t& cents) {
+        size_t i = 0;
+        bool negative = false;
+        if (i < text.size() && (text[i] == '+' || text[i] == '-')) {
+            negative = text[i] == '-';
+            i++;
+        }
+        
+        int64_t whole = 0;
+        size_t wholeDigits = 0;
+        while (i < text.size() && text[i] >= '0' && text[i] <= '9') {
+            if (++wholeDigits > 15) return parseSlow(text, cents);
+            whole = whole * 10 + (text[i++] - '0');
+        }
+        
+        int64_t fraction = 0;
+        size_t fractionDigits = 0;
+        bool roundUp = false;
+        if (i < text.size() && text[i] == '.') {
+            for (i++; i < text.size() && text[i] >= '0' && text[i] <= '9'; ++i, ++fractionDigits) {
+                if (fractionDigits < 2) fraction = fraction * 10 + (text[i] - '0');
+                else if (fractionDigits == 2) roundUp = text[i] >= '5';
+            }
+        }
+        
+        if (wholeDigits == 0 && fractionDigits == 0) return false;
+        if (i != text.size()) return parseSlow(text, cents);  // Exponents and the like
+        if (fractionDigits == 1) fraction *= 10;
+        
+        cents = whole * 100 + fraction + (roundUp ? 1 : 0);
+        if (negative) cents = -cents;
+        return true;
+    }
+    
+    static std::string format(int64_t cents) {
+        char buffer[24];
+        char* end = buffer + sizeof(buffer);
+        char* p = end;
+        uint64_t magnitude = cents < 0 ? 0 - static_cast<uint64_t>(cents) : static_cast<uint64_t>(cents);
+        
+        *--p = static_cast<char>('0' + magnitude % 10);
+        *--p = static_cast<char>('0' + magnitude / 10 % 10);
+        *--p = '.';
+        magnitude /= 100;
+        do {
+            *--p = static_cast<char>('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude != 0);
+        if (cents < 0) *--p = '-';
+        return std::string(p, end);
+    }
+
+private:
+    static bool parseSlow(std::string_view text, int64_t& cents) {
+        if (!text.empty() && text.front() == '+') text.remove_prefix(1);
+        
+        double value = 0.0;
+        auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (result.ec != std::errc() || result.ptr != text.data() + text.size() ||
+            !std::isfinite(value) || std::fabs(value) >= 1e15) {
+            return false;
+        }
+        cents = std::llround(value * 100);
+        return true;
+    }
+};
+
+// Process-wide operation metrics: latency histograms per operation plus
+// byte, row and allocation counters. Collection is off unless enabled with
+// --stats or --stats-export; while off, every probe is a single relaxed
+// load and branch.
+class Metrics {
+public:
+    enum Operation { Load, Save, Import, Search, Report, Add, Edit, Remove, Export, OperationCount };
+    enum Counter { BytesRead, BytesWritten, RowsParsed, RowsRejected, Allocations, CounterCount };
+    
+    // Times one operation for as long as it is in scope
+    class Timer {
+    private:
+        Operation operation;
+        bool active;
+        std::chrono::steady_clock::time_point start;
+        
+    public:
+        explicit Timer(Operation op) : operation(op), active(Metrics::enabled()) {
+            if (active) start = std::chrono::steady_clock::now();
+        }
+        
+        ~Timer() {
+            if (!active) return;
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            Metrics::record(operation, static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+        }
+    };
+    
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+    static void enable() { active.store(true, std::memory_order_relaxed); }
+    
+    static void add(Counter counter, uint64_t amount) {
+        if (enabled()) counters[counter].fetch_add(amount, std::memory_order_relaxed);
+    }
+    
+    // Also write the JSON form to path every interval seconds while enabled
+    static void exportTo(const std::string& path, int intervalSeconds = 10) {
+        std::lock_guard<std::mutex> lock(exportMutex);
+        exportPath = path;
+        exportInterval = std::chrono::seconds(intervalSeconds);
+        lastExport = std::chrono::steady_clock::now();
+        enable();
+    }
+    
+    static void record(Operation operation, uint64_t micros) {
+        Histogram& histogram = histograms[operation];
+        histogram.buckets[bucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+        histogram.count.fetch_add(1, std::memory_order_relaxed);
+        histogram.totalMicros.fetch_add(micros, std::memory_order_relaxed);
+        uint64_t seen = histogram.maxMicros.load(std::memory_order_relaxed);
+        while (micros > seen && !histogram.maxMicros.compare_exchange_weak(seen, micros, std::memory_order_relaxed)) {}
+        
+        if (!exportPath.empty()) exportIfDue();
+    }
+    
+    static void printReport(std::ostream& out) {
+        out << "\n=== OPERATION STATISTICS ===\n";
+        out << std::left << std::setw(8) << "op" << std::right << std::setw(10) << "count"
+            << std::setw(12) << "mean us" << std::setw(12) << "p50 us" << std::setw(12) << "p99 us"
+            << std::setw(12) << "max us" << "\n";
+        for (int op = 0; op < OperationCount; ++op) {
+            const Histogram& histogram = histograms[op];
+            uint64_t count = histogram.count.load(std::memory_order_relaxed);
+            if (count == 0) continue;
+            out << std::left << std::setw(8) << operationNames()[op] << std::right << std::setw(10) << count
+                << std::setw(12) << histogram.totalMicros.load(std::memory_order_relaxed) / count
+                << std::setw(12) << percentile(histogram, 0.50) << std::setw(12) << percentile(histogram, 0.99)
+                << std::setw(12) << histogram.maxMicros.load(std::memory_order_relaxed) << "\n";
+        }
+        for (int counter = 0; counter < CounterCount; ++counter) {
+            if (!counted(counter)) continue;
+            out << counterNames()[counter] << ": " << counters[counter].load(std::memory_order_relaxed) << "\n";
+        }
+        out << "(percentiles are power-of-two bucket upper bounds)\n";
+    }
+    
+    static void writeJSON(std::ostream& out) {
+        out << "{\"operations\":{";
+        for (int op = 0; op < OperationCount; ++op) {
+            const Histogram& histogram = histograms[op];
+            out << (op ? "," : "") << "\"" << operationNames()[op] << "\":{\"count\":"
+                << histogram.count.load(std::memory_order_relaxed)
+                << ",\"total_us\":" << histogram.totalMicros.load(std::memory_order_relaxed)
+                << ",\"max_us\":" << histogram.maxMicros.load(std::memory_order_relaxed)
+                << ",\"p50_us\":" << percentile(histogram, 0.50)
+                << ",\"p99_us\":" << percentile(histogram, 0.99) << ",\"buckets\":[";
+            for (int b = 0; b < BUCKETS; ++b) {
+                out << (b ? "," : "") << histogram.buckets[b].load(std::memory_order_relaxed);
+            }
+            out << "]}";
+        }
+        out << "},\"counters\":{";
+        for (int counter = 0; counter < CounterCount; ++counter) {
+            if (!counted(counter)) continue;
+            out << (counter ? "," : "") << "\"" << counterNames()[counter] << "\":"
+                << counters[counter].load(std::memory_order_relaxed);
+        }
+        out << "}}\n";
+    }
+    
+    // Write the export file now, e.g. on exit
+    static void exportNow() {
+        std::lock_guard<std::mutex> lock(exportMutex);
+        if (!exportPath.empty()) writeExport();
+    }
+
+private:
+    // Bucket b counts latencies below 2^b microseconds
+    static const int BUCKETS = 32;
+    struct Histogram {
+        std::atomic<uint64_t> buckets[BUCKETS];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> totalMicros;
+        std::atomic<uint64_t> maxMicros;
+    };
+    
+    static inline std::atomic<bool> active{false};
+    static inline Histogram histograms[OperationCount];
+    static inline std::atomic<uint64_t> counters[CounterCount];
+    
+    static inline std::mutex exportMutex;
+    static inline std::string exportPath;
+    static inline std::chrono::steady_clock::duration exportInterval;
+    static inline std::chrono::steady_clock::time_point lastExport;
+    
+    static const char* const* operationNames() {
+        static const char* const names[OperationCount] = {
+            "load", "save", "import", "search", "report", "add", "edit", "remove", "export"
+        };
+        return names;
+    }
+    
+    static const char* const* counterNames() {
+        static const char* const names[CounterCount] = {
+            "bytes_read", "bytes_written", "rows_parsed", "rows_rejected", "allocations"
+        };
+        return names;
+    }
+    
+    // Allocations are only counted when the build replaces operator new;
+    // Allocations is the last counter, so skipping it keeps the JSON valid
+    static bool counted(int counter) {
+#ifdef EXPENSE_TRACKER_COUNT_ALLOCATIONS
+        (void)counter;
+        return true;
+#else
+        return counter != Allocations;
+#endif
+    }
+    
+    static int bucketOf(uint64_t micros) {
+        int bucket = 0;
+        while (micros != 0 && bucket < BUCKETS - 1) {
+            micros >>= 1;
+            bucket++;
+        }
+        return bucket;
+    }
+    
+    static uint64_t percentile(const Histogram& histogram, double fraction) {
+        uint64_t count = histogram.count.load(std::memory_order_relaxed);
+        uint64_t rank = static_cast<uint64_t>(std::ceil(fraction * count));
+        uint64_t seen = 0;
+        for (int b = 0; b < BUCKETS; ++b) {
+            seen += histogram.buckets[b].load(std::memory_order_relaxed);
+            if (seen >= rank && seen > 0) {
+                uint64_t bound = b == 0 ? 0 : (uint64_t(1) << b) - 1;
+                return std::min(bound, histogram.maxMicros.load(std::memory_order_relaxed));
+            }
+        }
+        return 0;
+    }
+    
+    static void exportIfDue() {
+        std::unique_lock<std::mutex> lock(exportMutex, std::try_to_lock);
+        if (!lock.owns_lock() || exportPath.empty()) return;
+        if (std::chrono::steady_clock::now() - lastExport < exportInterval) return;
+        writeExport();
+    }
+    
+    // Caller holds exportMutex. Replaced atomically so readers never see a
+    // partial file.
+    static void writeExport() {
+        lastExport = std::chrono::steady_clock::now();
+        std::string tempFile = exportPath + ".tmp";
+        {
+            std::ofstream file(tempFile);
+            if (!file.is_open()) return;
+            writeJSON(file);
+        }
+        std::rename(tempFile.c_str(), exportPath.c_str());
+    }
+};
+
+// Count allocations for Metrics when built with EXPENSE_TRACKER_COUNT_ALLOCATIONS.
+// Off by default, since the replacement applies to every program that
+// includes this file. Only the plain forms are replaced, which new[] and
+// the nothrow forms call into; over-aligned allocations are not counted, so
+// the figure is approximate.
+#ifdef EXPENSE_TRACKER_COUNT_ALLOCATIONS
+void* operator new(std::size_t size) {
+    Metrics::add(Metrics::Allocations, 1);
+    if (size == 0) size = 1;
+    while (true) {
+        if (void* memory = std::malloc(size)) return memory;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+// Kept out of line so GCC does not pair the inlined free() with a new
+// expression and warn about mismatched allocation functions
+[[gnu::noinline]] void operator delete(void* memory) noexcept { std::free(memory); }
+[[gnu::noinline]] void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+#endif
+
+// Process-wide table of category names. Each distinct name gets a dense
+// integer id so rows store four bytes instead of a string, and group-bys
+// index flat arrays by id. Names live in fixed blocks that never move, so
+// name() needs no lock and may run while another thread interns; only
+// interning and lookups by name are serialized.
+class CategoryDictionary {
+private:
+    static const size_t BLOCK_NAMES = 1024;
+    static const size_t MAX_BLOCKS = 4096;
+    
+    std::unique_ptr<std::string[]> blocks[MAX_BLOCKS];
+    std::atomic<uint32_t> count{0};
+    std::unordered_map<std::string_view, uint32_t> ids;
+    mutable std::mutex internMutex;
+
+public:
+    static CategoryDictionary& global() {
+        static CategoryDictionary dictionary;
+        return dictionary;
+    }
+    
+    uint32_t intern(std::string_view name) {
+        std::lock_guard<std::mutex> lock(internMutex);
+        auto it = ids.find(name);
+        if (it != ids.end()) return it->second;
+        
+        uint32_t id = count.load(std::memory_order_relaxed);
+        if (id / BLOCK_NAMES >= MAX_BLOCKS) throw std::length_error("Too many categories");
+        std::unique_ptr<std::string[]>& block = blocks[id / BLOCK_NAMES];
+        if (!block) block.reset(new std::string[BLOCK_NAMES]);
+        block[id % BLOCK_NAMES] = std::string(name);
+        ids.emplace(block[id % BLOCK_NAMES], id);
+        count.store(id + 1, std::memory_order_release);
+        return id;
+    }
+    
+    // Look up a name without adding it
+    bool find(std::string_view name, uint32_t& id) const {
+        std::lock_guard<std::mutex> lock(internMutex);
+        auto it = ids.find(name);
+        if (it == ids.end()) return false;
+        id = it->second;
+        return true;
+    }
+    
+    const std::string& name(uint32_t id) const { return blocks[id / BLOCK_NAMES][id % BLOCK_NAMES]; }
+    size_t size() const { return count.load(std::memory_order_acquire); }
+    
+    // Ids ordered by name, for reports that list categories alphabetically
+    std::vector<uint32_t> sortedIds() const {
+        std::vector<uint32_t> sorted(size());
+        for (uint32_t id = 0; id < sorted.size(); ++id) {
+            sorted[id] = id;
+        }
+        std::sort(sorted.begin(), sorted.end(),
+            [this](uint32_t a, uint32_t b) { return name(a) < name(b); });
+        return sorted;
+    }
+};
+
 class Expense {
 private:
     static int nextId;
     int id;
-    double amount;
-    std::string category;
+    int64_t amount;  // Cents
+    uint32_t categoryId;
     std::string description;
     Date date;
 
 public:
-    Expense(double amt, const std::string& cat, const std::string& desc, const Date& d = Date())
-        : id(nextId++), amount(amt), category(cat), description(desc), date(d) {}
+    Expense(int64_t amt, const std::string& cat, const std::string& desc, const Date& d = Date())
+        : id(nextId++), amount(amt), categoryId(CategoryDictionary::global().intern(cat)),
+          description(desc), date(d) {}
+    
+    Expense(int i, int64_t amt, const std::string& cat, const std::string& desc, const Date& d)
+        : id(i), amount(amt), categoryId(CategoryDictionary::global().intern(cat)),
+          description(desc), date(d) {
+        if (i >= nextId) nextId = i + 1;
+    }
+    
+    Expense(int i, int64_t amt, uint32_t catId, const std::string& desc, const Date& d)
+        : id(i), amount(amt), categoryId(catId), description(desc), date(d) {
+        if (i >= nextId) nextId = i + 1;
+    }
     
-    Expense(int i, double amt, const std::string& cat, const std::string& desc, const Date& d)
-        : id(i), amount(amt), category(cat), description(desc), date(d) {
+    // Id bookkeeping for rows that live in an ExpenseStore rather than
+    // as Expense objects
+    static int allocateId() { return nextId++; }
+    static void reserveId(int i) {
         if (i >= nextId) nextId = i + 1;
     }
     
     int getId() const { return id; }
-    double getAmount() const { return amount; }
-    std::string getCategory() const { return category; }
-    std::string getDescription() const { return description; }
+    int64_t getAmount() const { return amount; }
+    const std::string& getCategory() const { return CategoryDictionary::global().name(categoryId); }
+    uint32_t getCategoryId() const { return categoryId; }
+    const std::string& getDescription() const { return description; }
     Date getDate() const { return date; }
     
-    void setAmount(double amt) { amount = amt; }
-    void setCategory(const std::string& cat) { category = cat; }
+    void setAmount(int64_t amt) { amount = amt; }
+    void setCategory(const std::string& cat) { categoryId = CategoryDictionary::global().intern(cat); }
     void setDescription(const std::string& desc) { description = desc; }
     
     std::string toString() const {
         std::stringstream ss;
-        ss << std::fixed << std::setprecision(2);
-        ss << "ID: " << id << " | Amount: " << amount 
-           << " | Category: " << category << " | Description: " << description 
+        ss << "ID: " << id << " | Amount: " << Money::format(amount) 
+           << " | Category: " << getCategory() << " | Description: " << description 
            << " | Date: " << date.toString();
         return ss.str();
     }
     
     std::string toFileString() const {
         std::stringstream ss;
-        ss << std::fixed << std::setprecision(2);
-        ss << id << "," << amount << "," << category << "," << description << "," << date.toFileString();
+        ss << id << "," << Money::format(amount) << "," << getCategory() << "," << description << "," << date.toFileString();
         return ss.str();
     }
     
@@ -115,7 +527,8 @@ public:
         
         if (parts.size() >= 7) {
             int id = stoi(parts[0]);
-            double amount = stod(parts[1]);
+            int64_t amount = 0;
+            if (!Money::parse(parts[1], amount)) throw std::runtime_error("Invalid amount");
             std::string category = parts[2];
             std::string description = parts[3];
             Date date(stoi(parts[4]), stoi(parts[5]), stoi(parts[6]));
@@ -123,716 +536,5263 @@ public:
             return Expense(id, amount, category, description, date);
         }
         
-        return Expense(0, 0.0, "", "", Date());
+        return Expense(0, 0, "", "", Date());
     }
 };
 
 int Expense::nextId = 1;
 
+// A CSV row decoded off the loader threads. Ids are only handed out, and
+// categories interned, once rows are merged back in file order; until then
+// category and description are the raw fields inside the loaded file.
+struct ParsedExpense {
+    int id;  // 0 when the file has no Id column
+    Date date;
+    int64_t amount;  // Cents
+    std::string_view category;
+    std::string_view description;
+};
 
+// Read-only view of a whole file. The file is memory-mapped where the
+// platform supports it and read into a single buffer otherwise.
+class MappedFile {
+private:
+    const char* data = nullptr;
+    size_t length = 0;
+    bool opened = false;
+    bool mapped = false;
+    std::string buffer;
 
-class ExpenseTracker {
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef EXPENSE_TRACKER_HAS_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            opened = true;
+            length = static_cast<size_t>(st.st_size);
+            if (length > 0) {
+                void* addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (addr != MAP_FAILED) {
+                    madvise(addr, length, MADV_SEQUENTIAL);
+                    data = static_cast<const char*>(addr);
+                    mapped = true;
+                } else {
+                    opened = false;
+                    length = 0;
+                }
+            }
+        }
+        ::close(fd);
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) return;
+        
+        opened = true;
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        buffer = contents.str();
+        data = buffer.data();
+        length = buffer.size();
+#endif
+        Metrics::add(Metrics::BytesRead, length);
+    }
+    
+    ~MappedFile() {
+#ifdef EXPENSE_TRACKER_HAS_MMAP
+        if (mapped) munmap(const_cast<char*>(data), length);
+#endif
+    }
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    bool isOpen() const { return opened; }
+    std::string_view view() const { return std::string_view(data, length); }
+};
+
+// Exclusive hold on a ledger: an flock on <csv>.lock, kept until
+// destruction. The kernel drops it when the process exits, however it
+// exits, so a crash never leaves the ledger locked. Without file locks
+// every ledger counts as held.
+class LedgerLock {
 private:
-    std::vector<Expense> expenses;
-    //Budget budget;
-    std::string csvFile;  // Primary CSV file
-    std::string budgetFile;
+    int fd = -1;
+    std::string failure;
 
 public:
-    ExpenseTracker(const std::string& csvFileName = "expenses.csv") 
-                  //const std::string& budgetFileName = "budget.txt")
-        : csvFile(csvFileName){
-        loadFromCSV();  // Always load from CSV
-        //loadBudget();
+    explicit LedgerLock(const std::string& csv) {
+#ifdef EXPENSE_TRACKER_HAS_FILE_LOCKS
+        std::string path = csv + ".lock";
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            failure = "Could not open '" + path + "': " + std::strerror(errno);
+            return;
+        }
+        if (::flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            failure = errno == EWOULDBLOCK ? "'" + csv + "' is open in another process"
+                                           : "Could not lock '" + path + "': " + std::strerror(errno);
+            ::close(fd);
+            fd = -1;
+        }
+#else
+        (void)csv;
+#endif
     }
     
-    ~ExpenseTracker() {
-        saveToCSV();  // Always save to CSV
-        //saveBudget();
+    ~LedgerLock() {
+#ifdef EXPENSE_TRACKER_HAS_FILE_LOCKS
+        if (fd >= 0) ::close(fd);
+#endif
     }
     
-    void addExpense(double amount, const std::string& category, 
-                   const std::string& description, const Date& date = Date()) {
-        expenses.emplace_back(amount, category, description, date);
-        std::cout << "Expense added successfully!\n";
-        
-        // Immediately save to CSV
-        saveToCSV();
-        
-        // Check budget warning
-        //checkBudgetWarning(category);
+    LedgerLock(const LedgerLock&) = delete;
+    LedgerLock& operator=(const LedgerLock&) = delete;
+    
+    bool held() const { return failure.empty(); }
+    const std::string& error() const { return failure; }
+};
+
+// Copy-on-write storage, so that read snapshots share the ledger with the
+// live store instead of copying it. Values sit in boxes stamped with the
+// epoch of the owner that wrote them; an owner changes a box in place only
+// while the stamp matches its current epoch. Copying an owner moves both
+// sides to fresh epochs, so from then on each copies a box it still shares
+// before its first write to it. A copy that is only read can be read on
+// other threads while the original carries on changing.
+class WriteEpoch {
+private:
+    mutable std::atomic<uint64_t> current{next()};
+    
+    static uint64_t next() {
+        static std::atomic<uint64_t> counter{1};
+        return counter.fetch_add(1, std::memory_order_relaxed);
     }
+
+public:
+    WriteEpoch() = default;
     
-    void removeExpenseById(int id) {
-        auto it = std::find_if(expenses.begin(), expenses.end(),
-            [id](const Expense& e) { return e.getId() == id; });
-        
-        if (it != expenses.end()) {
-            expenses.erase(it);
-            std::cout << "Expense removed successfully!\n";
-            
-            // Immediately save to CSV
-            saveToCSV();
-        } else {
-            std::cout << "Expense with ID " << id << " not found!\n";
+    // Changes the source's epoch too, so callers copying an owner must
+    // keep its writers out, as they must for any copy
+    WriteEpoch(const WriteEpoch& other) { other.current.store(next(), std::memory_order_relaxed); }
+    
+    WriteEpoch& operator=(const WriteEpoch& other) {
+        current.store(next(), std::memory_order_relaxed);
+        other.current.store(next(), std::memory_order_relaxed);
+        return *this;
+    }
+    
+    operator uint64_t() const { return current.load(std::memory_order_relaxed); }
+};
+
+// One copy-on-write box, empty until the first edit
+template <typename T>
+class SharedValue {
+private:
+    struct Box {
+        uint64_t epoch;
+        T value;
+    };
+    std::shared_ptr<Box> box;
+
+public:
+    bool empty() const { return !box; }
+    
+    // Must not be empty
+    const T& operator*() const { return box->value; }
+    const T* operator->() const { return &box->value; }
+    
+    // The value to change under epoch, made or copied first if need be
+    T& edit(uint64_t epoch) {
+        if (!box) {
+            box = std::make_shared<Box>(Box{epoch, T()});
+        } else if (box->epoch != epoch) {
+            box = std::make_shared<Box>(Box{epoch, box->value});
         }
+        return box->value;
     }
+};
+
+// A column of values in copy-on-write chunks of 2^CHUNK_BITS, so a write
+// copies at most one chunk and copying the column copies only pointers.
+// Each chunk is contiguous, for kernels that want plain arrays.
+template <typename T, size_t CHUNK_BITS = 12>
+class SharedColumn {
+public:
+    static const size_t CHUNK = size_t(1) << CHUNK_BITS;
     
-    void editExpenseById(int id) {
-        auto it = std::find_if(expenses.begin(), expenses.end(),
-            [id](const Expense& e) { return e.getId() == id; });
+    class const_iterator {
+    private:
+        const SharedColumn* column;
+        size_t i;
+
+    public:
+        const_iterator(const SharedColumn* c, size_t at) : column(c), i(at) {}
+        const T& operator*() const { return (*column)[i]; }
+        const_iterator& operator++() { ++i; return *this; }
+        bool operator!=(const const_iterator& other) const { return i != other.i; }
+    };
+
+private:
+    std::vector<SharedValue<std::vector<T>>> chunks;
+    std::vector<const T*> bases;  // chunk(c).data(), saving reads a hop
+    size_t count = 0;
+    
+    std::vector<T>& own(size_t c, uint64_t epoch) {
+        std::vector<T>& values = chunks[c].edit(epoch);
+        bases[c] = values.data();
+        return values;
+    }
+
+public:
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return bases[i >> CHUNK_BITS][i & (CHUNK - 1)]; }
+    const T& back() const { return (*this)[count - 1]; }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, count); }
+    
+    // Chunk c holds elements [c * CHUNK, c * CHUNK + chunk(c).size())
+    size_t chunkCount() const { return chunks.size(); }
+    const std::vector<T>& chunk(size_t c) const { return *chunks[c]; }
+    
+    T& edit(size_t i, uint64_t epoch) { return own(i >> CHUNK_BITS, epoch)[i & (CHUNK - 1)]; }
+    
+    void push_back(const T& value, uint64_t epoch) {
+        size_t c = count >> CHUNK_BITS;
+        if (c == chunks.size()) {
+            chunks.emplace_back();
+            bases.push_back(nullptr);
+            // Columns that fill one chunk tend to fill the next
+            if (c > 0) own(c, epoch).reserve(CHUNK);
+        }
+        std::vector<T>& values = chunks[c].edit(epoch);
+        values.push_back(value);
+        bases[c] = values.data();
+        count++;
+    }
+    
+    // Keep the first n values
+    void truncate(size_t n, uint64_t epoch) {
+        if (n >= count) return;
+        chunks.resize((n + CHUNK - 1) >> CHUNK_BITS);
+        bases.resize(chunks.size());
+        if (n & (CHUNK - 1)) own(chunks.size() - 1, epoch).resize(n & (CHUNK - 1));
+        count = n;
+    }
+    
+    void clear() {
+        chunks.clear();
+        bases.clear();
+        count = 0;
+    }
+};
+
+// A hash map in 2^SHARD_BITS copy-on-write shards. Shards are picked by
+// the key's hash less its low bits, so runs of neighbouring integer keys
+// such as new ids land in one shard and a burst of inserts stays in cache.
+template <typename Key, typename Value, size_t SHARD_BITS = 8>
+class SharedMap {
+private:
+    using Shard = std::unordered_map<Key, Value>;
+    std::vector<SharedValue<Shard>> shards;  // Empty until the first insert
+    size_t count = 0;
+    
+    static size_t shardOf(const Key& key) {
+        return (std::hash<Key>()(key) >> 10) & ((size_t(1) << SHARD_BITS) - 1);
+    }
+    
+    Shard& shard(const Key& key, uint64_t epoch) {
+        if (shards.empty()) shards.resize(size_t(1) << SHARD_BITS);
+        return shards[shardOf(key)].edit(epoch);
+    }
+
+public:
+    size_t size() const { return count; }
+    
+    // nullptr if key is absent
+    const Value* find(const Key& key) const {
+        if (shards.empty()) return nullptr;
+        const SharedValue<Shard>& s = shards[shardOf(key)];
+        if (s.empty()) return nullptr;
+        auto it = s->find(key);
+        return it == s->end() ? nullptr : &it->second;
+    }
+    
+    // The value for key, default-constructed if key is new
+    Value& edit(const Key& key, uint64_t epoch) {
+        auto inserted = shard(key, epoch).try_emplace(key);
+        if (inserted.second) count++;
+        return inserted.first->second;
+    }
+    
+    void erase(const Key& key, uint64_t epoch) {
+        if (find(key)) count -= shard(key, epoch).erase(key);
+    }
+    
+    void reserve(size_t n, uint64_t epoch) {
+        if (shards.empty()) shards.resize(size_t(1) << SHARD_BITS);
+        for (SharedValue<Shard>& s : shards) s.edit(epoch).reserve((n >> SHARD_BITS) + 1);
+    }
+    
+    void clear() {
+        shards.clear();
+        count = 0;
+    }
+};
+
+// Inverted index over description tokens, with a trigram index over the
+// token vocabulary for substring lookups. Posting lists hold store slots
+// and are only ever appended to; entries left behind by edits and removals
+// are filtered out by the caller, which re-checks every candidate. Built
+// from copy-on-write pieces, so copies share it.
+class KeywordIndex {
+private:
+    SharedColumn<std::string> tokens;
+    SharedMap<std::string, uint32_t> tokenIds;
+    SharedColumn<SharedColumn<uint32_t>> postings;  // Slots per token, ascending per add
+    SharedMap<uint32_t, SharedColumn<uint32_t>> trigrams;  // Token ids per trigram
+    WriteEpoch epoch;
+
+    static bool isTokenChar(unsigned char c) {
+        return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c >= 0x80;
+    }
+    
+    static uint32_t trigramAt(std::string_view text, size_t i) {
+        return (static_cast<uint32_t>(static_cast<unsigned char>(text[i])) << 16) |
+               (static_cast<uint32_t>(static_cast<unsigned char>(text[i + 1])) << 8) |
+               static_cast<uint32_t>(static_cast<unsigned char>(text[i + 2]));
+    }
+    
+    uint32_t internToken(std::string_view token) {
+        std::string key(token);
+        if (const uint32_t* known = tokenIds.find(key)) return *known;
         
-        if (it != expenses.end()) {
-            editExpenseHelper(*it);
-        } else {
-            std::cout << "Expense with ID " << id << " not found!\n";
+        uint32_t id = static_cast<uint32_t>(tokens.size());
+        tokens.push_back(key, epoch);
+        postings.push_back(SharedColumn<uint32_t>(), epoch);
+        tokenIds.edit(key, epoch) = id;
+        
+        for (size_t i = 0; i + 3 <= token.size(); ++i) {
+            SharedColumn<uint32_t>& list = trigrams.edit(trigramAt(token, i), epoch);
+            if (list.empty() || list.back() != id) list.push_back(id, epoch);
         }
+        return id;
     }
     
-    void editExpenseInteractive() {
-        if (expenses.empty()) {
-            std::cout << "No expenses recorded.\n";
+    // Split text into maximal runs of token characters
+    template <typename Visitor>
+    static void forEachToken(std::string_view text, Visitor visit) {
+        size_t start = 0;
+        while (start < text.size()) {
+            while (start < text.size() && !isTokenChar(text[start])) start++;
+            size_t end = start;
+            while (end < text.size() && isTokenChar(text[end])) end++;
+            if (end > start) visit(text.substr(start, end - start));
+            start = end;
+        }
+    }
+    
+    // Vocabulary tokens that contain piece
+    void tokensContaining(std::string_view piece, std::vector<uint32_t>& result) const {
+        if (piece.size() < 3) {
+            for (uint32_t id = 0; id < tokens.size(); ++id) {
+                if (tokens[id].find(piece) != std::string::npos) result.push_back(id);
+            }
             return;
         }
         
-        std::cout << "\n=== FIND EXPENSE TO EDIT ===\n";
-        std::cout << "1. Search by keyword and select\n";
-        std::cout << "2. Browse recent expenses\n";
-        std::cout << "3. Browse by category\n";
-        std::cout << "4. Enter expense ID directly\n";
-        std::cout << "Choose search method: ";
+        // Verify against the rarest of the piece's trigrams
+        const SharedColumn<uint32_t>* shortest = nullptr;
+        for (size_t i = 0; i + 3 <= piece.size(); ++i) {
+            const SharedColumn<uint32_t>* list = trigrams.find(trigramAt(piece, i));
+            if (!list) return;
+            if (!shortest || list->size() < shortest->size()) shortest = list;
+        }
+        for (uint32_t id : *shortest) {
+            if (tokens[id].find(piece) != std::string::npos) result.push_back(id);
+        }
+    }
+
+public:
+    void clear() {
+        tokenIds.clear();
+        tokens.clear();
+        postings.clear();
+        trigrams.clear();
+    }
+    
+    void add(uint32_t slot, std::string_view text) {
+        forEachToken(text, [&](std::string_view token) {
+            SharedColumn<uint32_t>& list = postings.edit(internToken(token), epoch);
+            if (list.empty() || list.back() != slot) list.push_back(slot, epoch);
+        });
+    }
+    
+    // Slots whose text may contain keyword, sorted and unique. Every text
+    // containing keyword contains a token that contains each of keyword's
+    // own token pieces, so the longest piece narrows the search. Returns
+    // false when keyword has no token characters and cannot be narrowed.
+    bool candidates(std::string_view keyword, std::vector<uint32_t>& slots) const {
+        std::string_view longest;
+        forEachToken(keyword, [&](std::string_view piece) {
+            if (piece.size() > longest.size()) longest = piece;
+        });
+        if (longest.empty()) return false;
         
-        int choice;
-        std::cin >> choice;
+        std::vector<uint32_t> matchingTokens;
+        tokensContaining(longest, matchingTokens);
+        for (uint32_t id : matchingTokens) {
+            for (uint32_t slot : postings[id]) slots.push_back(slot);
+        }
         
-        switch (choice) {
-            case 1:
-                findAndEditByKeyword();
-                break;
-            case 2:
-                findAndEditRecent();
-                break;
-            case 3:
-                findAndEditByCategory();
-                break;
-            case 4: {
-                int id;
-                std::cout << "Enter expense ID: ";
-                std::cin >> id;
-                editExpenseById(id);
-                break;
-            }
-            default:
-                std::cout << "Invalid choice.\n";
+        std::sort(slots.begin(), slots.end());
+        slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+        return true;
+    }
+};
+
+// Running totals in cents per category id, kept up to date as rows change
+// so summaries cost O(categories) rather than a pass over every expense.
+struct CategoryTotals {
+    int64_t total = 0;
+    size_t rows = 0;
+    std::vector<int64_t> amounts;  // Indexed by CategoryDictionary id
+    std::vector<size_t> counts;
+    
+    // Add count rows totalling amount
+    void add(uint32_t category, int64_t amount, size_t count = 1) {
+        if (category >= amounts.size()) {
+            amounts.resize(category + 1, 0);
+            counts.resize(category + 1, 0);
         }
+        total += amount;
+        rows += count;
+        amounts[category] += amount;
+        counts[category] += count;
     }
     
-    void removeExpenseInteractive() {
-        if (expenses.empty()) {
-            std::cout << "No expenses recorded.\n";
-            return;
+    void merge(const CategoryTotals& other) {
+        for (uint32_t category = 0; category < other.counts.size(); ++category) {
+            if (other.counts[category] > 0) add(category, other.amounts[category], other.counts[category]);
         }
-        
-        std::cout << "\n=== FIND EXPENSE TO REMOVE ===\n";
+    }
+    
+    void remove(uint32_t category, int64_t amount) {
+        total -= amount;
+        rows--;
+        amounts[category] -= amount;
+        counts[category]--;
+    }
+    
+    int64_t amount(uint32_t category) const {
+        return category < amounts.size() ? amounts[category] : 0;
+    }
+    
+    size_t count(uint32_t category) const {
+        return category < counts.size() ? counts[category] : 0;
+    }
+};
+
+// Spending by day as Fenwick trees, one per year for the whole ledger and
+// one per year and category. Days are indexed (month - 1) * 31 + day - 1,
+// which sorts like Date::toPacked. A range total costs two O(log 372)
+// prefix sums for the years at either end and one running total per year
+// in between; updates touch two trees. Years are copy-on-write, so
+// copies share every year but the ones changed since.
+class DailyTotals {
+public:
+    static constexpr uint32_t ALL = std::numeric_limits<uint32_t>::max();  // Every category
+    enum class Period { Week, Month, Year };
+    
+    // Parse "week", "month" or "year"
+    static bool parsePeriod(std::string_view name, Period& period) {
+        if (name == "week") {
+            period = Period::Week;
+        } else if (name == "month") {
+            period = Period::Month;
+        } else if (name == "year") {
+            period = Period::Year;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t DAYS = 12 * 31;
+    
+    struct Year {
+        std::vector<int64_t> all;  // 1-based Fenwick tree, DAYS + 1 entries
+        std::vector<std::vector<int64_t>> byCategory;  // Empty until the category is used
+        CategoryTotals totals;
+        
+        // Sum of day slots [from, to)
+        int64_t sum(size_t from, size_t to, uint32_t category) const {
+            if (from == 0 && to == DAYS) return category == ALL ? totals.total : totals.amount(category);
+            if (category == ALL) return prefix(all, to) - prefix(all, from);
+            if (category >= byCategory.size()) return 0;
+            return prefix(byCategory[category], to) - prefix(byCategory[category], from);
+        }
+    };
+    std::map<int, SharedValue<Year>> years;
+    WriteEpoch epoch;
+    
+    static void update(std::vector<int64_t>& tree, size_t day, int64_t amount) {
+        if (tree.empty()) tree.assign(DAYS + 1, 0);
+        for (size_t i = day + 1; i <= DAYS; i += i & (0 - i)) tree[i] += amount;
+    }
+    
+    // Sum of the first days slots
+    static int64_t prefix(const std::vector<int64_t>& tree, size_t days) {
+        if (tree.empty()) return 0;
+        int64_t sum = 0;
+        for (size_t i = days; i > 0; i -= i & (0 - i)) sum += tree[i];
+        return sum;
+    }
+    
+    // Day slots of a year that sort before bound. bound may be any packed
+    // value, not only a real date: day 0 or month 13 mark a boundary.
+    static size_t daysBefore(uint64_t bound) {
+        uint64_t month = (bound >> 5) & 15;
+        uint64_t day = bound & 31;
+        if (month == 0) return 0;
+        return std::min<size_t>(DAYS, (month - 1) * 31 + (day == 0 ? 0 : day - 1));
+    }
+    
+    static size_t dayOf(uint32_t date) { return daysBefore(date); }
+    
+    void change(uint32_t date, uint32_t category, int64_t amount) {
+        Year& year = years[static_cast<int>(date >> 9)].edit(epoch);
+        if (category >= year.byCategory.size()) year.byCategory.resize(category + 1);
+        update(year.all, dayOf(date), amount);
+        update(year.byCategory[category], dayOf(date), amount);
+    }
+
+public:
+    void add(uint32_t date, uint32_t category, int64_t amount) {
+        change(date, category, amount);
+        years[static_cast<int>(date >> 9)].edit(epoch).totals.add(category, amount);
+    }
+    
+    void remove(uint32_t date, uint32_t category, int64_t amount) {
+        change(date, category, -amount);
+        auto it = years.find(static_cast<int>(date >> 9));
+        CategoryTotals& totals = it->second.edit(epoch).totals;
+        totals.remove(category, amount);
+        if (totals.rows == 0) years.erase(it);
+    }
+    
+    void clear() { years.clear(); }
+    
+    // Total in cents of expenses dated within [first, last], for one
+    // category or ALL
+    int64_t total(uint32_t first, uint32_t last, uint32_t category = ALL) const {
+        if (last < first) return 0;
+        uint64_t end = static_cast<uint64_t>(last) + 1;  // Exclusive
+        int firstYear = static_cast<int>(first >> 9);
+        int64_t endYear = static_cast<int64_t>(end >> 9);
+        
+        int64_t sum = 0;
+        for (auto it = years.lower_bound(firstYear); it != years.end() && it->first <= endYear; ++it) {
+            size_t from = it->first == firstYear ? daysBefore(first) : 0;
+            size_t to = it->first == endYear ? daysBefore(end) : DAYS;
+            if (from < to) sum += it->second->sum(from, to, category);
+        }
+        return sum;
+    }
+    
+    // Totals over [first, last] in calendar weeks (Monday to Sunday),
+    // months or years, each keyed by its first day within the range.
+    // Periods without expenses are included with a zero total.
+    std::vector<std::pair<uint32_t, int64_t>> rollup(uint32_t first, uint32_t last, Period period,
+                                                     uint32_t category = ALL) const {
+        std::vector<std::pair<uint32_t, int64_t>> buckets;
+        uint32_t start = first;
+        while (start <= last) {
+            int year = static_cast<int>(start >> 9);
+            int month = static_cast<int>((start >> 5) & 15);
+            uint32_t next;
+            if (period == Period::Week) {
+                // 1970-01-01 was a Thursday
+                int64_t day = dayNumber(start);
+                int64_t weekday = ((day % 7) + 10) % 7;  // 0 is Monday
+                next = fromDayNumber(day + 7 - weekday);
+            } else if (period == Period::Month) {
+                next = month == 12 ? Date(1, 1, year + 1).toPacked() : Date(1, month + 1, year).toPacked();
+            } else {
+                next = Date(1, 1, year + 1).toPacked();
+            }
+            
+            uint32_t end = std::min(last, next - 1);
+            buckets.emplace_back(start, total(start, end, category));
+            if (end == last) break;
+            start = next;
+        }
+        return buckets;
+    }
+    
+    // Days since 1970-01-01, proleptic Gregorian. Out-of-range days such as
+    // 31-02 roll over into the following month.
+    static int64_t dayNumber(uint32_t date) {
+        int64_t year = static_cast<int64_t>(date >> 9);
+        int64_t month = (date >> 5) & 15;
+        int64_t day = date & 31;
+        year -= month <= 2;
+        int64_t era = (year >= 0 ? year : year - 399) / 400;
+        int64_t yearOfEra = year - era * 400;
+        int64_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+        int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+        return era * 146097 + dayOfEra - 719468;
+    }
+    
+    static uint32_t fromDayNumber(int64_t days) {
+        days += 719468;
+        int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+        int64_t dayOfEra = days - era * 146097;
+        int64_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        int64_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        int64_t shifted = (5 * dayOfYear + 2) / 153;
+        int day = static_cast<int>(dayOfYear - (153 * shifted + 2) / 5 + 1);
+        int month = static_cast<int>(shifted < 10 ? shifted + 3 : shifted - 9);
+        return Date(day, month, static_cast<int>(yearOfEra + era * 400 + (month <= 2))).toPacked();
+    }
+};
+
+// KLL quantile sketch over amounts in cents. Level h holds items that
+// each stand for 2^h values; when a level fills up it is sorted and every
+// other item, starting from a random one of the first two, moves up a
+// level. Capacities shrink by 2/3 per level below the top, so space stays
+// O(K) however many values are added, with rank error around 1-2% at
+// K = 200. Until the first compaction the sketch is exact.
+class QuantileSketch {
+private:
+    static const size_t K = 200;
+    static constexpr size_t MIN_CAPACITY = 8;
+    
+    std::vector<std::vector<int64_t>> levels;
+    std::vector<size_t> capacities;  // Per level, recomputed as levels are added
+    uint64_t n = 0;
+    uint64_t coin = 0x9e3779b97f4a7c15ULL;  // xorshift state; a fixed seed keeps results repeatable
+    
+    void grow() {
+        levels.emplace_back();
+        capacities.resize(levels.size());
+        for (size_t level = 0; level < levels.size(); ++level) {
+            double capacity = K * std::pow(2.0 / 3.0, static_cast<double>(levels.size() - 1 - level));
+            capacities[level] = std::max(MIN_CAPACITY, static_cast<size_t>(capacity));
+        }
+    }
+    
+    bool flip() {
+        coin ^= coin << 13;
+        coin ^= coin >> 7;
+        coin ^= coin << 17;
+        return coin & 1;
+    }
+    
+    void compress() {
+        for (size_t level = 0; level < levels.size(); ++level) {
+            if (levels[level].size() < capacities[level]) continue;
+            if (level + 1 == levels.size()) grow();
+            
+            std::vector<int64_t>& items = levels[level];
+            std::sort(items.begin(), items.end());
+            bool odd = items.size() % 2 == 1;
+            int64_t left = odd ? items.back() : 0;  // An odd item out stays behind
+            if (odd) items.pop_back();
+            for (size_t i = flip() ? 1 : 0; i < items.size(); i += 2) {
+                levels[level + 1].push_back(items[i]);
+            }
+            items.clear();
+            if (odd) items.push_back(left);
+        }
+    }
+
+public:
+    void add(int64_t value) {
+        if (levels.empty()) grow();
+        levels[0].push_back(value);
+        n++;
+        if (levels[0].size() >= capacities[0]) compress();
+    }
+    
+    void merge(const QuantileSketch& other) {
+        if (other.n == 0) return;
+        while (levels.size() < other.levels.size()) grow();
+        for (size_t level = 0; level < other.levels.size(); ++level) {
+            levels[level].insert(levels[level].end(), other.levels[level].begin(), other.levels[level].end());
+        }
+        n += other.n;
+        compress();
+    }
+    
+    uint64_t count() const { return n; }
+    
+    // The value at rank ceil(q * count), q in [0, 1]; 0 when empty
+    int64_t quantile(double q) const {
+        std::vector<std::pair<int64_t, uint64_t>> weighted;
+        for (size_t level = 0; level < levels.size(); ++level) {
+            for (int64_t value : levels[level]) weighted.emplace_back(value, uint64_t(1) << level);
+        }
+        if (weighted.empty()) return 0;
+        std::sort(weighted.begin(), weighted.end());
+        
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(n))));
+        uint64_t seen = 0;
+        for (const auto& item : weighted) {
+            seen += item.second;
+            if (seen >= rank) return item.first;
+        }
+        return weighted.back().first;
+    }
+};
+
+// HyperLogLog count of distinct strings. Each hash picks one of 2^P byte
+// registers by its top bits, which keeps the longest run of leading zeros
+// seen in the rest. Standard error is 1.04 / sqrt(2^P), about 3% at
+// P = 10; small counts use linear counting over the empty registers.
+class DistinctSketch {
+private:
+    static const int P = 10;
+    static const size_t REGISTERS = size_t(1) << P;
+    std::vector<uint8_t> registers;  // Empty until the first add
+
+public:
+    // FNV-1a, then a 64-bit finalizer so every bit depends on every byte
+    static uint64_t hash(std::string_view text) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (char c : text) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 0x100000001b3ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+    
+    void addHash(uint64_t h) {
+        if (registers.empty()) registers.assign(REGISTERS, 0);
+        size_t index = static_cast<size_t>(h >> (64 - P));
+        uint64_t rest = h << P;
+        uint8_t rank = 1;
+        while (rank <= 64 - P && !(rest & (uint64_t(1) << 63))) {
+            rest <<= 1;
+            rank++;
+        }
+        registers[index] = std::max(registers[index], rank);
+    }
+    
+    void merge(const DistinctSketch& other) {
+        if (other.registers.empty()) return;
+        if (registers.empty()) registers.assign(REGISTERS, 0);
+        for (size_t i = 0; i < REGISTERS; ++i) {
+            registers[i] = std::max(registers[i], other.registers[i]);
+        }
+    }
+    
+    uint64_t estimate() const {
+        if (registers.empty()) return 0;
+        double sum = 0;
+        size_t zeros = 0;
+        for (uint8_t rank : registers) {
+            sum += std::ldexp(1.0, -rank);
+            zeros += rank == 0;
+        }
+        double m = static_cast<double>(REGISTERS);
+        double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+        if (estimate <= 2.5 * m && zeros > 0) estimate = m * std::log(m / static_cast<double>(zeros));
+        return static_cast<uint64_t>(std::llround(estimate));
+    }
+};
+
+// Amount quantiles and distinct descriptions for one group of expenses
+struct ExpenseSketch {
+    QuantileSketch amounts;
+    DistinctSketch descriptions;
+    
+    void add(int64_t amount, uint64_t descriptionHash) {
+        amounts.add(amount);
+        descriptions.addHash(descriptionHash);
+    }
+    
+    void merge(const ExpenseSketch& other) {
+        amounts.merge(other.amounts);
+        descriptions.merge(other.descriptions);
+    }
+};
+
+// ExpenseSketches per category and overall, for every month and for the
+// whole ledger. Sketches cannot forget a value, so removals and edits
+// mark their month stale instead; refresh rebuilds stale months from
+// their rows and then the ledger from the months. Months are
+// copy-on-write, so copies share the ones that have not changed.
+class LedgerSketches {
+public:
+    struct Group {
+        std::vector<ExpenseSketch> byCategory;  // Indexed by CategoryDictionary id
+        ExpenseSketch all;
+        
+        void add(uint32_t category, int64_t amount, std::string_view description) {
+            if (category >= byCategory.size()) byCategory.resize(category + 1);
+            uint64_t h = DistinctSketch::hash(description);
+            byCategory[category].add(amount, h);
+            all.add(amount, h);
+        }
+        
+        void merge(const Group& other) {
+            if (byCategory.size() < other.byCategory.size()) byCategory.resize(other.byCategory.size());
+            for (size_t category = 0; category < other.byCategory.size(); ++category) {
+                byCategory[category].merge(other.byCategory[category]);
+            }
+            all.merge(other.all);
+        }
+    };
+
+private:
+    std::map<uint32_t, SharedValue<Group>> months;  // Keyed by ExpenseStore::monthKey
+    std::set<uint32_t> staleMonths;
+    SharedValue<Group> ledger;  // Empty until something is added
+    bool ledgerStale = false;
+    WriteEpoch epoch;
+
+public:
+    void add(uint32_t month, uint32_t category, int64_t amount, std::string_view description) {
+        if (!staleMonths.count(month)) months[month].edit(epoch).add(category, amount, description);
+        if (!ledgerStale) ledger.edit(epoch).add(category, amount, description);
+    }
+    
+    void invalidate(uint32_t month) {
+        staleMonths.insert(month);
+        ledgerStale = true;
+    }
+    
+    bool stale() const { return ledgerStale; }
+    
+    void clear() {
+        months.clear();
+        staleMonths.clear();
+        ledger = SharedValue<Group>();
+        ledgerStale = false;
+    }
+    
+    // rowsOf(month, group) adds a month's current rows to group. Does
+    // nothing when no month is stale.
+    template <typename Rows>
+    void refresh(Rows rowsOf) {
+        if (!ledgerStale) return;
+        for (uint32_t month : staleMonths) {
+            SharedValue<Group> fresh;
+            rowsOf(month, fresh.edit(epoch));
+            if (fresh->all.amounts.count() == 0) {
+                months.erase(month);
+            } else {
+                months[month] = std::move(fresh);
+            }
+        }
+        staleMonths.clear();
+        
+        SharedValue<Group> whole;
+        Group& merged = whole.edit(epoch);
+        for (const auto& entry : months) merged.merge(*entry.second);
+        ledger = std::move(whole);
+        ledgerStale = false;
+    }
+    
+    // nullptr if nothing is dated in month
+    const Group* month(uint32_t key) const {
+        auto it = months.find(key);
+        return it == months.end() ? nullptr : &*it->second;
+    }
+    
+    const Group& whole() const {
+        static const Group none;
+        return ledger.empty() ? none : *ledger;
+    }
+};
+
+// A conjunction of row predicates; fields left at their defaults match
+// every row. Categories are compared by name so the same query can run
+// over files whose categories are not in the dictionary.
+struct ExpenseQuery {
+    uint32_t firstDate = 0;  // Date::toPacked, inclusive
+    uint32_t lastDate = std::numeric_limits<uint32_t>::max();
+    std::vector<std::string> categories;  // Sorted; empty matches any
+    int64_t minAmount = std::numeric_limits<int64_t>::min();  // Cents, inclusive
+    int64_t maxAmount = std::numeric_limits<int64_t>::max();
+    std::string keyword;  // Substring of the category or the description
+    
+    ExpenseQuery& between(const Date& from, const Date& to) {
+        firstDate = from.toPacked();
+        lastDate = to.toPacked();
+        return *this;
+    }
+    
+    ExpenseQuery& inCategory(const std::string& category) {
+        auto it = std::lower_bound(categories.begin(), categories.end(), category);
+        if (it == categories.end() || *it != category) categories.insert(it, category);
+        return *this;
+    }
+    
+    ExpenseQuery& amountBetween(int64_t min, int64_t max) {
+        minAmount = min;
+        maxAmount = max;
+        return *this;
+    }
+    
+    ExpenseQuery& containing(const std::string& text) {
+        keyword = text;
+        return *this;
+    }
+    
+    bool hasDateRange() const {
+        return firstDate != 0 || lastDate != std::numeric_limits<uint32_t>::max();
+    }
+    
+    bool matchesDate(uint32_t date) const { return date >= firstDate && date <= lastDate; }
+    bool matchesAmount(int64_t amount) const { return amount >= minAmount && amount <= maxAmount; }
+    
+    bool matchesCategory(std::string_view category) const {
+        return categories.empty() || std::binary_search(categories.begin(), categories.end(), category);
+    }
+    
+    bool matchesText(std::string_view category, std::string_view description) const {
+        return keyword.empty() || category.find(keyword) != std::string_view::npos ||
+               description.find(keyword) != std::string_view::npos;
+    }
+    
+    bool matches(uint32_t date, std::string_view category, int64_t amount, std::string_view description) const {
+        return matchesDate(date) && matchesAmount(amount) && matchesCategory(category) &&
+               matchesText(category, description);
+    }
+};
+
+// Bump allocator for the description column. Text is copied into large
+// blocks that never move, so the views it hands out stay valid until the
+// arena is cleared. Nothing is freed one string at a time; the store
+// rebuilds its arena once edits and removals have orphaned enough of it.
+// Copies share the blocks they start with and store new text in blocks
+// of their own, so a copy's views stay valid whatever the original does.
+class StringArena {
+private:
+    std::vector<std::shared_ptr<char[]>> blocks;
+    size_t blockSize = 0;  // Capacity of the last block
+    size_t blockUsed = 0;
+    size_t usedBytes = 0;
+    
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+public:
+    StringArena() = default;
+    
+    // The last block stays full as far as the copy is concerned
+    StringArena(const StringArena& other)
+        : blocks(other.blocks), blockSize(other.blockUsed), blockUsed(other.blockUsed),
+          usedBytes(other.usedBytes) {}
+    
+    StringArena& operator=(const StringArena&) = delete;
+    
+    // Make the next `bytes` bytes of stores contiguous in one block
+    void reserve(size_t bytes) {
+        if (bytes <= blockSize - blockUsed) return;
+        blockSize = std::max(BLOCK_SIZE, bytes);
+        blocks.emplace_back(new char[blockSize]);
+        blockUsed = 0;
+    }
+    
+    std::string_view store(std::string_view text) {
+        if (text.empty()) return std::string_view();
+        reserve(text.size());
+        char* at = blocks.back().get() + blockUsed;
+        std::memcpy(at, text.data(), text.size());
+        blockUsed += text.size();
+        usedBytes += text.size();
+        return std::string_view(at, text.size());
+    }
+    
+    // Bytes handed out since the last clear
+    size_t bytes() const { return usedBytes; }
+    
+    void clear() {
+        blocks.clear();
+        blockSize = blockUsed = usedBytes = 0;
+    }
+    
+    void swap(StringArena& other) {
+        blocks.swap(other.blocks);
+        std::swap(blockSize, other.blockSize);
+        std::swap(blockUsed, other.blockUsed);
+        std::swap(usedBytes, other.usedBytes);
+    }
+};
+
+// Structure-of-arrays storage for the ledger. Each field lives in its own
+// column so scans over amounts and dates never touch the string columns. Rows are addressed by slot; Expense objects are only
+// materialized for display. Removed rows are tombstoned rather than erased
+// so removal does not shift the columns, and an id index gives constant-time
+// lookup by expense id. Everything is held in copy-on-write pieces, so a
+// copy costs a few pointers per chunk of rows and shares all but the
+// chunks either side writes afterwards.
+class ExpenseStore {
+private:
+    SharedColumn<int> ids;
+    SharedColumn<int64_t> amounts;  // Cents
+    SharedColumn<uint32_t> dates;  // Date::toPacked
+    SharedColumn<uint32_t> categories;  // CategoryDictionary ids
+    SharedColumn<std::string_view> descriptions;  // Views into text
+    SharedColumn<uint8_t> live;  // 0 marks a removed row (tombstone)
+    SharedMap<int, size_t, 12> slotById;
+    size_t deadCount = 0;
+    StringArena text;
+    size_t orphanedBytes = 0;  // Arena bytes no longer referenced by a live row
+    
+    // Slots grouped by (year, month), keyed by Date::toPacked() >> 5 so the
+    // map iterates in date order. Slots stay ascending within a partition,
+    // and each partition carries that month's category totals.
+    struct MonthPartition {
+        SharedColumn<uint32_t> slots;
+        CategoryTotals totals;
+    };
+    std::map<uint32_t, SharedValue<MonthPartition>> months;
+    CategoryTotals totals;  // Whole ledger
+    DailyTotals daily;  // Range totals and rollups; unaffected by compaction
+    
+    // Built on the first keyword search, then kept up to date by appends
+    // and description edits; compaction drops it to be rebuilt on demand.
+    mutable KeywordIndex keywords;
+    mutable bool keywordsReady = false;
+    
+    // Built by the first refreshSketches, then fed by appends, with
+    // removals and edits leaving their month to be rebuilt by the next one
+    LedgerSketches sketches;
+    bool sketchesReady = false;
+    
+    uint64_t changes = 0;  // Bumped by every mutation, see version
+    std::map<int, uint64_t> yearChanges;  // changes as of each year's last mutation
+    WriteEpoch epoch;  // For the columns, slotById and months
+    
+    // Tombstones are swept once they make up a quarter of the slots
+    static const size_t MIN_TOMBSTONE_COMPACTION = 1024;
+    // The arena is repacked once half of it is orphaned text
+    static const size_t MIN_ARENA_REPACK = 1 << 20;
+    
+    void tombstone(size_t slot) {
+        touch(dates[slot]);
+        slotById.erase(ids[slot], epoch);
+        live.edit(slot, epoch) = 0;
+        if (sketchesReady) sketches.invalidate(monthKey(dates[slot]));
+        releaseText(slot);
+        months[monthKey(dates[slot])].edit(epoch).totals.remove(categories[slot], amounts[slot]);
+        totals.remove(categories[slot], amounts[slot]);
+        daily.remove(dates[slot], categories[slot], amounts[slot]);
+        deadCount++;
+    }
+    
+    void touch(uint32_t date) { yearChanges[yearOf(date)] = ++changes; }
+    
+    void compactIfSparse() {
+        if (deadCount >= MIN_TOMBSTONE_COMPACTION && deadCount * 4 >= ids.size()) {
+            compact();
+        }
+    }
+    
+    void releaseText(size_t slot) {
+        orphanedBytes += descriptions[slot].size();
+        descriptions.edit(slot, epoch) = std::string_view();
+    }
+    
+    // Copy the live descriptions into a fresh arena, in slot order
+    void repackText() {
+        size_t liveBytes = text.bytes() - orphanedBytes;
+        StringArena packed;
+        packed.reserve(liveBytes);
+        for (size_t slot = 0; slot < descriptions.size(); ++slot) {
+            std::string_view moved = packed.store(descriptions[slot]);
+            descriptions.edit(slot, epoch) = moved;
+        }
+        text.swap(packed);
+        orphanedBytes = 0;
+    }
+    
+    static bool& serialAggregates() {
+        static thread_local bool serial = false;
+        return serial;
+    }
+
+public:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+    
+    ExpenseStore() = default;
+    
+    // Shares everything with other until either side writes, so read
+    // snapshots are cheap. Slots stay the same, so the indexes carry over.
+    ExpenseStore(const ExpenseStore& other) = default;
+    
+    ExpenseStore& operator=(const ExpenseStore&) = delete;
+    
+    // Changes whenever the contents change; equal versions of the same
+    // store hold the same rows
+    uint64_t version() const { return changes; }
+    
+    // Changes whenever a row dated in year is added, removed or edited;
+    // 0 until the first such change since the store was last cleared
+    uint64_t yearVersion(int year) const {
+        auto it = yearChanges.find(year);
+        return it == yearChanges.end() ? 0 : it->second;
+    }
+    
+    // Number of live rows
+    size_t size() const { return ids.size() - deadCount; }
+    bool empty() const { return size() == 0; }
+    
+    // Number of slots, including tombstones; scans run over [0, slotCount())
+    size_t slotCount() const { return ids.size(); }
+    bool isLive(size_t slot) const { return live[slot] != 0; }
+    
+    // textBytes of description text are kept in one arena block
+    void reserve(size_t rows, size_t textBytes = 0) {
+        text.reserve(textBytes);
+        slotById.reserve(rows, epoch);
+    }
+    
+    void clear() {
+        changes++;
+        yearChanges.clear();
+        ids.clear();
+        amounts.clear();
+        dates.clear();
+        categories.clear();
+        descriptions.clear();
+        text.clear();
+        orphanedBytes = 0;
+        live.clear();
+        slotById.clear();
+        months.clear();
+        totals = CategoryTotals();
+        daily.clear();
+        keywords.clear();
+        keywordsReady = false;
+        sketches.clear();
+        sketchesReady = false;
+        deadCount = 0;
+    }
+    
+    static uint32_t monthKey(uint32_t packedDate) { return packedDate >> 5; }
+    static int yearOf(uint32_t packedDate) { return static_cast<int>(packedDate >> 9); }
+    
+    // Append the live slots dated within [first, last] to out, keeping
+    // their order. Used for the partial months at either end of a range.
+    void filterByDate(const SharedColumn<uint32_t>& slots, uint32_t first, uint32_t last,
+                      std::vector<size_t>& out) const {
+        for (size_t c = 0; c < slots.chunkCount(); ++c) {
+            const std::vector<uint32_t>& chunk = slots.chunk(c);
+            size_t i = 0;
+#ifdef __AVX2__
+            // Packed dates stay well below 2^31, so signed compares are safe.
+            // Slots ascend, so eight of them gather from one chunk of dates
+            // when the first and last do.
+            const __m256i below = _mm256_set1_epi32(static_cast<int>(first) - 1);
+            const __m256i above = _mm256_set1_epi32(static_cast<int>(last) + 1);
+            const size_t DATES = SharedColumn<uint32_t>::CHUNK;
+            for (; i + 8 <= chunk.size(); i += 8) {
+                size_t dateChunk = chunk[i] / DATES;
+                if (chunk[i + 7] / DATES != dateChunk) {
+                    for (size_t j = i; j < i + 8; ++j) {
+                        uint32_t slot = chunk[j];
+                        if (live[slot] && dates[slot] >= first && dates[slot] <= last) out.push_back(slot);
+                    }
+                    continue;
+                }
+                const int* base = reinterpret_cast<const int*>(dates.chunk(dateChunk).data());
+                __m256i index = _mm256_sub_epi32(
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(chunk.data() + i)),
+                    _mm256_set1_epi32(static_cast<int>(dateChunk * DATES)));
+                __m256i date = _mm256_i32gather_epi32(base, index, 4);
+                __m256i inRange = _mm256_and_si256(_mm256_cmpgt_epi32(date, below),
+                                                   _mm256_cmpgt_epi32(above, date));
+                int mask = _mm256_movemask_ps(_mm256_castsi256_ps(inRange));
+                for (int lane = 0; mask != 0; ++lane, mask >>= 1) {
+                    if ((mask & 1) && live[chunk[i + lane]]) out.push_back(chunk[i + lane]);
+                }
+            }
+#endif
+            for (; i < chunk.size(); ++i) {
+                uint32_t slot = chunk[i];
+                if (live[slot] && dates[slot] >= first && dates[slot] <= last) out.push_back(slot);
+            }
+        }
+    }
+    
+    // The id must not already be in the store
+    size_t append(int id, int64_t amount, uint32_t date, uint32_t categoryId, std::string_view description) {
+        touch(date);
+        size_t slot = ids.size();
+        std::string_view stored = text.store(description);
+        slotById.edit(id, epoch) = slot;
+        ids.push_back(id, epoch);
+        amounts.push_back(amount, epoch);
+        dates.push_back(date, epoch);
+        categories.push_back(categoryId, epoch);
+        descriptions.push_back(stored, epoch);
+        live.push_back(1, epoch);
+        
+        MonthPartition& partition = months[monthKey(date)].edit(epoch);
+        partition.slots.push_back(static_cast<uint32_t>(slot), epoch);
+        partition.totals.add(categoryId, amount);
+        totals.add(categoryId, amount);
+        daily.add(date, categoryId, amount);
+        
+        if (keywordsReady) keywords.add(static_cast<uint32_t>(slot), stored);
+        if (sketchesReady) sketches.add(monthKey(date), categoryId, amount, stored);
+        return slot;
+    }
+    
+    // Tombstone a row. May sweep tombstones, which renumbers slots.
+    void erase(size_t slot) {
+        tombstone(slot);
+        compactIfSparse();
+    }
+    
+    // Tombstone every row dated in year, to drop a partition from memory.
+    // May sweep tombstones, which renumbers slots.
+    void eraseYear(int year) {
+        auto end = months.upper_bound(monthKey(Date(1, 12, year).toPacked()));
+        for (auto it = months.lower_bound(monthKey(Date(1, 1, year).toPacked())); it != end; ++it) {
+            for (uint32_t slot : it->second->slots) {
+                if (live[slot]) tombstone(slot);
+            }
+        }
+        compactIfSparse();
+    }
+    
+    // Drop tombstoned rows, keeping the live ones in order
+    void compact() {
+        if (deadCount == 0) return;
+        changes++;
+        
+        size_t out = 0;
+        for (size_t slot = 0; slot < ids.size(); ++slot) {
+            if (!live[slot]) continue;
+            if (out != slot) {
+                ids.edit(out, epoch) = ids[slot];
+                amounts.edit(out, epoch) = amounts[slot];
+                dates.edit(out, epoch) = dates[slot];
+                categories.edit(out, epoch) = categories[slot];
+                descriptions.edit(out, epoch) = descriptions[slot];
+                live.edit(out, epoch) = 1;
+                slotById.edit(ids[out], epoch) = out;
+            }
+            out++;
+        }
+        
+        ids.truncate(out, epoch);
+        amounts.truncate(out, epoch);
+        dates.truncate(out, epoch);
+        categories.truncate(out, epoch);
+        descriptions.truncate(out, epoch);
+        live.truncate(out, epoch);
+        deadCount = 0;
+        repackText();
+        
+        months.clear();
+        totals = CategoryTotals();
+        for (size_t slot = 0; slot < out; ++slot) {
+            MonthPartition& partition = months[monthKey(dates[slot])].edit(epoch);
+            partition.slots.push_back(static_cast<uint32_t>(slot), epoch);
+            partition.totals.add(categories[slot], amounts[slot]);
+            totals.add(categories[slot], amounts[slot]);
+        }
+        
+        keywords.clear();
+        keywordsReady = false;
+    }
+    
+    // Candidate slots for a description substring search; see
+    // KeywordIndex::candidates. Candidates may be dead or stale.
+    bool descriptionCandidates(std::string_view keyword, std::vector<uint32_t>& slots) const {
+        buildKeywordIndex();
+        return keywords.candidates(keyword, slots);
+    }
+    
+    // Searches build the index on first use. Callers that search from
+    // several threads at once build it up front, under an exclusive lock.
+    void buildKeywordIndex() const {
+        if (keywordsReady) return;
+        for (size_t slot = 0; slot < ids.size(); ++slot) {
+            if (live[slot]) keywords.add(static_cast<uint32_t>(slot), descriptions[slot]);
+        }
+        keywordsReady = true;
+    }
+    
+    bool keywordIndexReady() const { return keywordsReady; }
+    
+    // Bring the sketches up to date. Unlike the keyword index they are never
+    // built from a read, so readers on several threads only ever see them
+    // as the last refresh left them.
+    void refreshSketches() {
+        if (!sketchesReady) {
+            for (size_t slot = 0; slot < ids.size(); ++slot) {
+                if (live[slot]) sketches.add(monthKey(dates[slot]), categories[slot], amounts[slot], descriptions[slot]);
+            }
+            sketchesReady = true;
+        }
+        sketches.refresh([this](uint32_t month, LedgerSketches::Group& group) {
+            auto it = months.find(month);
+            if (it == months.end()) return;
+            for (uint32_t slot : it->second->slots) {
+                if (live[slot]) group.add(categories[slot], amounts[slot], descriptions[slot]);
+            }
+        });
+    }
+    
+    bool sketchesCurrent() const { return sketchesReady && !sketches.stale(); }
+    
+    // Sketches for the whole ledger, as of the last refreshSketches
+    const LedgerSketches::Group& ledgerSketches() const { return sketches.whole(); }
+    
+    // Sketches for one month, or nullptr if nothing is dated in it, as of
+    // the last refreshSketches
+    const LedgerSketches::Group* monthSketches(int month, int year) const {
+        if (month < 1 || month > 12 || year < 0) return nullptr;
+        return sketches.month(monthKey(Date(1, month, year).toPacked()));
+    }
+    
+    // Access paths for select
+    enum class QueryPlan { FullScan, MonthIndex, KeywordIndex };
+    
+    static const char* planName(QueryPlan plan) {
+        switch (plan) {
+            case QueryPlan::MonthIndex: return "month-index";
+            case QueryPlan::KeywordIndex: return "keyword-index";
+            default: return "full-scan";
+        }
+    }
+    
+    // Append the live slots matching query to out in ascending order, and
+    // return the access path used. The planner estimates how many rows each
+    // path would visit and takes the cheapest. Every candidate is checked
+    // against the whole query, integer columns first, so descriptions are
+    // only read for rows that pass everything else.
+    QueryPlan select(const ExpenseQuery& query, std::vector<size_t>& out) const {
+        RowFilter filter(query);
+        std::vector<uint32_t> candidates;
+        QueryPlan plan = choosePlan(filter, candidates);
+        execute(filter, plan, candidates, out);
+        return plan;
+    }
+    
+    // Call visit(slot) for each live slot matching query, in slot order,
+    // without collecting the slots first
+    template <typename Visit>
+    void scan(const ExpenseQuery& query, Visit visit) const {
+        RowFilter filter(query);
+        for (size_t slot = 0; slot < ids.size(); ++slot) {
+            if (passes(filter, slot)) visit(slot);
+        }
+    }
+    
+    enum class GroupBy { Category, Month, CategoryMonth };
+    
+    // Rows and total in cents for one group. month is a monthKey and
+    // category a dictionary id; whichever is not grouped on is 0.
+    struct Group {
+        uint32_t category = 0;
+        uint32_t month = 0;
+        size_t count = 0;
+        int64_t total = 0;
+    };
+    
+    // Group the rows matching query, in key order. Full scans run straight
+    // over the columns and index plans over the slots they select. Either
+    // way the rows are split into chunks, one per core, each worker fills
+    // its own partial table, and the tables are merged at the end. Small
+    // queries, and any on a thread marked by aggregateSerially, run on the
+    // calling thread alone.
+    std::vector<Group> aggregate(const ExpenseQuery& query, GroupBy by, QueryPlan* used = nullptr) const {
+        RowFilter filter(query);
+        std::vector<uint32_t> candidates;
+        QueryPlan plan = choosePlan(filter, candidates);
+        if (used) *used = plan;
+        
+        std::vector<size_t> slots;
+        bool scanAll = plan == QueryPlan::FullScan;
+        if (!scanAll) execute(filter, plan, candidates, slots);
+        size_t rows = scanAll ? ids.size() : slots.size();
+        
+        size_t workers = std::min<size_t>(std::thread::hardware_concurrency(), rows / MIN_AGGREGATE_ROWS);
+        if (workers < 1 || serialAggregates()) workers = 1;
+        
+        // Categories index a flat table; months are sparse, so they hash
+        struct Partial {
+            std::vector<Group> byCategory;
+            std::unordered_map<uint64_t, Group> byKey;  // monthKey << 32 | category
+        };
+        std::vector<Partial> partials(workers);
+        size_t categoryCount = filter.categoryOk.size();
+        auto aggregateChunk = [&](size_t c) {
+            Partial& partial = partials[c];
+            if (by == GroupBy::Category) partial.byCategory.resize(categoryCount);
+            uint64_t lastKey = std::numeric_limits<uint64_t>::max();
+            Group* group = nullptr;  // Rows tend to come in date order
+            size_t begin = rows / workers * c;
+            size_t end = c + 1 == workers ? rows : rows / workers * (c + 1);
+            
+            auto groupOf = [&](size_t slot) {
+                if (by == GroupBy::Category) return &partial.byCategory[categories[slot]];
+                uint64_t key = (static_cast<uint64_t>(monthKey(dates[slot])) << 32) |
+                               (by == GroupBy::CategoryMonth ? categories[slot] : 0);
+                if (key != lastKey) {
+                    group = &partial.byKey[key];
+                    lastKey = key;
+                }
+                return group;
+            };
+            
+            if (scanAll) {
+                for (size_t slot = begin; slot < end; ++slot) {
+                    if (!passes(filter, slot)) continue;
+                    Group* into = groupOf(slot);
+                    into->count++;
+                    into->total += amounts[slot];
+                }
+                return;
+            }
+            
+            // Index plans hand over ascending slots, in which a group's rows
+            // mostly sit together; each run of them is summed at once
+            size_t runFrom = begin;
+            Group* run = nullptr;
+            for (size_t i = begin; i <= end; ++i) {
+                Group* into = i < end ? groupOf(slots[i]) : nullptr;
+                if (into == run) continue;
+                if (run) {
+                    run->count += i - runFrom;
+                    run->total += sumAmounts(slots.data() + runFrom, i - runFrom);
+                }
+                run = into;
+                runFrom = i;
+            }
+        };
+        
+        std::vector<std::thread> threads;
+        for (size_t c = 1; c < workers; ++c) {
+            threads.emplace_back(aggregateChunk, c);
+        }
+        aggregateChunk(0);
+        for (auto& t : threads) {
+            t.join();
+        }
+        
+        std::vector<Group> groups;
+        if (by == GroupBy::Category) {
+            for (uint32_t category = 0; category < categoryCount; ++category) {
+                Group merged;
+                merged.category = category;
+                for (const Partial& partial : partials) {
+                    merged.count += partial.byCategory[category].count;
+                    merged.total += partial.byCategory[category].total;
+                }
+                if (merged.count > 0) groups.push_back(merged);
+            }
+            return groups;
+        }
+        
+        std::map<uint64_t, Group> merged;
+        for (const Partial& partial : partials) {
+            for (const auto& entry : partial.byKey) {
+                Group& group = merged[entry.first];
+                group.count += entry.second.count;
+                group.total += entry.second.total;
+            }
+        }
+        for (auto& entry : merged) {
+            entry.second.month = static_cast<uint32_t>(entry.first >> 32);
+            entry.second.category = static_cast<uint32_t>(entry.first);
+            groups.push_back(entry.second);
+        }
+        return groups;
+    }
+    
+    // Threads that already run one per core, such as the server's workers,
+    // mark themselves so that their queries do not start threads of their own
+    static void aggregateSerially(bool serial) { serialAggregates() = serial; }
+    
+    // Sum in cents of the amounts at n ascending slots. Under AVX2 four
+    // slots are gathered at once when they fall in one chunk of the column.
+    int64_t sumAmounts(const size_t* slots, size_t n) const {
+        int64_t total = 0;
+        size_t i = 0;
+#ifdef __AVX2__
+        const size_t AMOUNTS = SharedColumn<int64_t>::CHUNK;
+        __m256i sums = _mm256_setzero_si256();
+        for (; i + 4 <= n; i += 4) {
+            size_t chunk = slots[i] / AMOUNTS;
+            if (slots[i + 3] / AMOUNTS != chunk) {
+                for (size_t j = i; j < i + 4; ++j) total += amounts[slots[j]];
+                continue;
+            }
+            const long long* base = reinterpret_cast<const long long*>(amounts.chunk(chunk).data());
+            __m256i index = _mm256_sub_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(slots + i)),
+                                             _mm256_set1_epi64x(static_cast<long long>(chunk * AMOUNTS)));
+            sums = _mm256_add_epi64(sums, _mm256_i64gather_epi64(base, index, 8));
+        }
+        alignas(32) int64_t lanes[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), sums);
+        total += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+        for (; i < n; ++i) total += amounts[slots[i]];
+        return total;
+    }
+    
+    // (month, year) pairs that have at least one live expense
+    std::vector<std::pair<int, int>> availableMonths() const {
+        std::vector<std::pair<int, int>> result;
+        for (const auto& partition : months) {
+            if (partition.second->totals.rows == 0) continue;
+            Date date = Date::fromPacked(partition.first << 5);
+            result.push_back({date.getMonth(), date.getYear()});
+        }
+        return result;
+    }
+    
+    bool contains(int id) const { return slotById.find(id) != nullptr; }
+    
+    // Slot holding the given id, or npos if there is none
+    size_t findSlot(int id) const {
+        const size_t* slot = slotById.find(id);
+        return slot ? *slot : npos;
+    }
+    
+    int id(size_t slot) const { return ids[slot]; }
+    int64_t amount(size_t slot) const { return amounts[slot]; }
+    uint32_t date(size_t slot) const { return dates[slot]; }
+    uint32_t categoryId(size_t slot) const { return categories[slot]; }
+    const std::string& category(size_t slot) const { return CategoryDictionary::global().name(categories[slot]); }
+    // Valid until the next mutation of the store
+    std::string_view description(size_t slot) const { return descriptions[slot]; }
+    
+    void setAmount(size_t slot, int64_t amount) {
+        touch(dates[slot]);
+        CategoryTotals& monthTotals = months[monthKey(dates[slot])].edit(epoch).totals;
+        monthTotals.remove(categories[slot], amounts[slot]);
+        totals.remove(categories[slot], amounts[slot]);
+        daily.remove(dates[slot], categories[slot], amounts[slot]);
+        if (sketchesReady) sketches.invalidate(monthKey(dates[slot]));
+        amounts.edit(slot, epoch) = amount;
+        monthTotals.add(categories[slot], amount);
+        totals.add(categories[slot], amount);
+        daily.add(dates[slot], categories[slot], amount);
+    }
+    
+    void setCategory(size_t slot, const std::string& category) {
+        touch(dates[slot]);
+        CategoryTotals& monthTotals = months[monthKey(dates[slot])].edit(epoch).totals;
+        monthTotals.remove(categories[slot], amounts[slot]);
+        totals.remove(categories[slot], amounts[slot]);
+        daily.remove(dates[slot], categories[slot], amounts[slot]);
+        if (sketchesReady) sketches.invalidate(monthKey(dates[slot]));
+        categories.edit(slot, epoch) = CategoryDictionary::global().intern(category);
+        monthTotals.add(categories[slot], amounts[slot]);
+        totals.add(categories[slot], amounts[slot]);
+        daily.add(dates[slot], categories[slot], amounts[slot]);
+    }
+    
+    const CategoryTotals& ledgerTotals() const { return totals; }
+    const DailyTotals& dailyTotals() const { return daily; }
+    
+    // Totals for one month, or nullptr if nothing was ever dated in it
+    const CategoryTotals* monthTotals(int month, int year) const {
+        if (month < 1 || month > 12 || year < 0) return nullptr;
+        auto it = months.find(monthKey(Date(1, month, year).toPacked()));
+        return it == months.end() ? nullptr : &it->second->totals;
+    }
+    
+    // Totals over the months of one year
+    CategoryTotals yearTotals(int year) const {
+        CategoryTotals yearTotals;
+        auto end = months.upper_bound(monthKey(Date(1, 12, year).toPacked()));
+        for (auto it = months.lower_bound(monthKey(Date(1, 1, year).toPacked())); it != end; ++it) {
+            yearTotals.merge(it->second->totals);
+        }
+        return yearTotals;
+    }
+    
+    void setDescription(size_t slot, std::string_view description) {
+        touch(dates[slot]);
+        releaseText(slot);
+        std::string_view stored = text.store(description);
+        descriptions.edit(slot, epoch) = stored;
+        if (keywordsReady) keywords.add(static_cast<uint32_t>(slot), stored);
+        if (sketchesReady) sketches.invalidate(monthKey(dates[slot]));
+        if (orphanedBytes >= MIN_ARENA_REPACK && orphanedBytes * 2 >= text.bytes()) {
+            repackText();
+        }
+    }
+    
+    const SharedColumn<int>& idColumn() const { return ids; }
+    const SharedColumn<int64_t>& amountColumn() const { return amounts; }
+    const SharedColumn<uint32_t>& dateColumn() const { return dates; }
+    const SharedColumn<uint32_t>& categoryColumn() const { return categories; }
+    const SharedColumn<uint8_t>& liveColumn() const { return live; }
+    
+    Expense at(size_t slot) const {
+        return Expense(ids[slot], amounts[slot], categories[slot], std::string(descriptions[slot]),
+                       Date::fromPacked(dates[slot]));
+    }
+
+private:
+    // Fewest rows worth a thread of their own when aggregating
+    static const size_t MIN_AGGREGATE_ROWS = 1 << 16;
+    
+    // A query's category predicates decided once per dictionary id
+    struct RowFilter {
+        const ExpenseQuery& query;
+        std::vector<char> categoryOk;
+        std::vector<char> categoryText;  // Name contains the keyword
+        bool textInCategories = false;
+        
+        explicit RowFilter(const ExpenseQuery& q) : query(q) {
+            const CategoryDictionary& dictionary = CategoryDictionary::global();
+            size_t count = dictionary.size();
+            categoryOk.resize(count);
+            categoryText.resize(count);
+            for (uint32_t id = 0; id < count; ++id) {
+                categoryOk[id] = query.matchesCategory(dictionary.name(id));
+                categoryText[id] = !query.keyword.empty() && dictionary.name(id).find(query.keyword) != std::string::npos;
+                textInCategories = textInCategories || (categoryOk[id] && categoryText[id]);
+            }
+        }
+    };
+    
+    bool passes(const RowFilter& filter, size_t slot) const {
+        uint32_t category = categories[slot];
+        return live[slot] && filter.categoryOk[category] && filter.query.matchesDate(dates[slot]) &&
+               filter.query.matchesAmount(amounts[slot]) &&
+               (filter.query.keyword.empty() || filter.categoryText[category] ||
+                descriptions[slot].find(filter.query.keyword) != std::string_view::npos);
+    }
+    
+    // The cheapest access path, filling candidates for the keyword index
+    QueryPlan choosePlan(const RowFilter& filter, std::vector<uint32_t>& candidates) const {
+        const ExpenseQuery& query = filter.query;
+        QueryPlan plan = QueryPlan::FullScan;
+        size_t cost = size();
+        if (query.hasDateRange() && query.firstDate <= query.lastDate) {
+            size_t rows = 0;
+            auto end = months.upper_bound(monthKey(query.lastDate));
+            for (auto it = months.lower_bound(monthKey(query.firstDate)); it != end; ++it) {
+                rows += it->second->totals.rows;
+            }
+            if (rows < cost) {
+                plan = QueryPlan::MonthIndex;
+                cost = rows;
+            }
+        }
+        
+        // Rows matched by category name are not in the token index; when a
+        // category matches the keyword they come from one pass over the
+        // integer category column instead
+        if (!query.keyword.empty() && descriptionCandidates(query.keyword, candidates) &&
+            candidates.size() < cost) {
+            plan = QueryPlan::KeywordIndex;
+        }
+        return plan;
+    }
+    
+    void execute(const RowFilter& filter, QueryPlan plan, const std::vector<uint32_t>& candidates,
+                 std::vector<size_t>& out) const {
+        const ExpenseQuery& query = filter.query;
+        size_t first = out.size();
+        if (plan == QueryPlan::MonthIndex) {
+            uint32_t firstMonth = monthKey(query.firstDate);
+            uint32_t lastMonth = monthKey(query.lastDate);
+            std::vector<size_t> boundary;
+            auto end = months.upper_bound(lastMonth);
+            for (auto it = months.lower_bound(firstMonth); it != end; ++it) {
+                if (firstMonth < it->first && it->first < lastMonth) {
+                    for (uint32_t slot : it->second->slots) {
+                        if (passes(filter, slot)) out.push_back(slot);
+                    }
+                } else {
+                    // Partial months at either end of the range
+                    boundary.clear();
+                    filterByDate(it->second->slots, query.firstDate, query.lastDate, boundary);
+                    for (size_t slot : boundary) {
+                        if (passes(filter, slot)) out.push_back(slot);
+                    }
+                }
+            }
+            std::sort(out.begin() + first, out.end());
+        } else if (plan == QueryPlan::KeywordIndex) {
+            for (uint32_t slot : candidates) {
+                if (passes(filter, slot)) out.push_back(slot);
+            }
+            if (filter.textInCategories) {
+                for (size_t slot = 0; slot < categories.size(); ++slot) {
+                    if (filter.categoryText[categories[slot]] && passes(filter, slot)) out.push_back(slot);
+                }
+                std::sort(out.begin() + first, out.end());
+                out.erase(std::unique(out.begin() + first, out.end()), out.end());
+            }
+        } else {
+            for (size_t slot = 0; slot < ids.size(); ++slot) {
+                if (passes(filter, slot)) out.push_back(slot);
+            }
+        }
+    }
+};
+
+// Spending limits for one category, or for all spending, per calendar
+// week (Monday to Sunday), month or year. Checks read a period's spending
+// from DailyTotals, so each costs a couple of prefix sums however many
+// expenses the period holds. The tracker saves limits to its budget file.
+class Budget {
+public:
+    using Period = DailyTotals::Period;
+    
+    struct Limit {
+        uint32_t category;  // CategoryDictionary id, or DailyTotals::ALL
+        Period period;
+        int64_t amount;  // Cents
+    };
+    
+    // Spending against one limit in one period
+    struct Status {
+        Limit limit;
+        uint32_t first;  // Date::toPacked, inclusive
+        uint32_t last;
+        int64_t spent;
+        
+        bool exceeded() const { return spent > limit.amount; }
+        int64_t percent() const { return limit.amount > 0 ? spent * 100 / limit.amount : 0; }
+    };
+    
+    // A limit's index in limits() and the first day of one of its periods
+    using PeriodKey = std::pair<size_t, uint32_t>;
+    
+    // Spending at this share of a limit draws a warning
+    static const int WARN_PERCENT = 90;
+
+private:
+    std::vector<Limit> limitList;
+
+public:
+    bool empty() const { return limitList.empty(); }
+    const std::vector<Limit>& limits() const { return limitList; }
+    void clear() { limitList.clear(); }
+    
+    // Replace the limit for category and period; an amount of 0 removes it.
+    // Returns false if there was nothing to remove.
+    bool set(uint32_t category, Period period, int64_t amount) {
+        for (auto it = limitList.begin(); it != limitList.end(); ++it) {
+            if (it->category != category || it->period != period) continue;
+            if (amount == 0) {
+                limitList.erase(it);
+            } else {
+                it->amount = amount;
+            }
+            return true;
+        }
+        if (amount == 0) return false;
+        limitList.push_back(Limit{category, period, amount});
+        return true;
+    }
+    
+    static uint32_t periodStart(uint32_t date, Period period) {
+        if (period == Period::Week) {
+            // 1970-01-01 was a Thursday
+            int64_t day = DailyTotals::dayNumber(date);
+            return DailyTotals::fromDayNumber(day - ((day % 7) + 10) % 7);
+        }
+        if (period == Period::Month) return (date & ~uint32_t(31)) | 1;
+        return (date & ~uint32_t(511)) | (1 << 5) | 1;
+    }
+    
+    // Last day of the period starting at first
+    static uint32_t periodEnd(uint32_t first, Period period) {
+        if (period == Period::Week) return DailyTotals::fromDayNumber(DailyTotals::dayNumber(first) + 6);
+        if (period == Period::Year) return (first & ~uint32_t(511)) | (12 << 5) | 31;
+        uint32_t next = ((first >> 5) & 15) == 12 ? (((first >> 9) + 1) << 9) | (1 << 5) | 1 : first + (1 << 5);
+        return DailyTotals::fromDayNumber(DailyTotals::dayNumber(next) - 1);
+    }
+    
+    static const char* periodName(Period period) {
+        if (period == Period::Week) return "week";
+        return period == Period::Month ? "month" : "year";
+    }
+    
+    // Add the periods that an expense dated date in category counts towards
+    void touch(uint32_t date, uint32_t category, std::set<PeriodKey>& periods) const {
+        for (size_t i = 0; i < limitList.size(); ++i) {
+            if (limitList[i].category == DailyTotals::ALL || limitList[i].category == category) {
+                periods.emplace(i, periodStart(date, limitList[i].period));
+            }
+        }
+    }
+    
+    // Spending in each of periods, or only in those at WARN_PERCENT of
+    // their limit or more when warningsOnly is set
+    std::vector<Status> evaluate(const DailyTotals& daily, const std::set<PeriodKey>& periods,
+                                 bool warningsOnly = true) const {
+        std::vector<Status> result;
+        for (const PeriodKey& key : periods) {
+            const Limit& limit = limitList[key.first];
+            uint32_t last = periodEnd(key.second, limit.period);
+            Status status{limit, key.second, last, daily.total(key.second, last, limit.category)};
+            if (!warningsOnly || status.spent * 100 >= limit.amount * WARN_PERCENT) result.push_back(status);
+        }
+        return result;
+    }
+};
+
+class ExpenseTracker {
+    friend class ExpenseTrackerBenchmark;  // Times the private load/save paths
+    
+private:
+    ExpenseStore expenses;
+    Budget budget;
+    std::string csvFile;  // Primary CSV file
+    std::string journalFile;  // Append-only log of mutations since the last CSV snapshot
+    std::string manifestFile;  // Index of the per-year snapshot partitions
+    std::string budgetFile;  // Spending limits, see loadBudget
+    bool budgetDirty = false;  // Limits changed by a batch that has not committed
+    std::ofstream journal;
+    size_t journalEntries = 0;  // Journal records not yet in the CSV
+    uint64_t journalBytes = 0;  // Journal file size, 0 when there is none
+    uint64_t journalHeaderBytes = 0;  // Where those records start in the file
+    uint64_t journalBase = 0;  // Checksum of the CSV the journal applies to
+    
+    // Years that have a snapshot partition file, see loadManifest. Only
+    // resident years have their rows in expenses; the newest year always
+    // does, and up to MAX_COLD_PARTITIONS others stay after use.
+    struct Partition {
+        uint64_t generation = 0;  // Save that wrote the file
+        size_t rows = 0;
+        int minId = 0;
+        int maxId = 0;
+        bool resident = false;
+        uint64_t lastUse = 0;  // partitionClock when last needed
+        uint64_t savedVersion = 0;  // expenses.yearVersion when the rows last matched the file
+        CategoryTotals totals;  // Of the rows in the file
+    };
+    std::map<int, Partition> partitions;
+    uint64_t partitionGeneration = 0;
+    uint64_t partitionClock = 0;
+    int hotYear = 0;
+    
+    static const size_t MAX_COLD_PARTITIONS = 3;
+    bool dirty = false;  // Changes in neither the CSV nor the journal (imports, batches)
+    
+    // Background writer, see writerLoop. storeMutex guards the store and the
+    // persistence state above; the menu thread only takes it to mutate, since
+    // the writer itself only reads the store. Server reads take it shared,
+    // see serveCommand.
+    std::shared_mutex storeMutex;
+    std::condition_variable_any writerWake;
+    std::condition_variable_any writerDone;
+    std::thread writer;
+    uint64_t saveRequests = 0;
+    uint64_t savesDone = 0;
+    size_t saveWaiters = 0;
+    size_t lastSavedRows = 0;
+    bool lastSaveOk = true;
+    bool saving = false;
+    bool stopWriter = false;
+    
+    // Immutable copies of the ledger for server reads, see pinSnapshot.
+    // Readers hold a snapshot through its shared_ptr; it is freed when the
+    // last reader drops it after a newer one has been published.
+    struct LedgerSnapshot {
+        ExpenseStore store;
+        std::map<int, Partition> partitions;  // Every year the store holds is resident
+        
+        LedgerSnapshot(const ExpenseStore& ledger, const std::map<int, Partition>& years)
+            : store(ledger), partitions(years) {}
+    };
+    std::mutex snapshotMutex;  // Taken before storeMutex, never after
+    std::shared_ptr<const LedgerSnapshot> snapshot;
+    uint64_t snapshotVersion = 0;  // expenses.version() when snapshot was taken
+    
+    // Minimum gap between background saves; requests in between coalesce
+    static constexpr std::chrono::milliseconds SAVE_INTERVAL{1000};
+
+    // Fold the journal back into the CSV once it holds this many records,
+    // or a quarter of the ledger, whichever is larger.
+    static const size_t MIN_JOURNAL_COMPACTION = 1024;
+    
+    // Files smaller than this are parsed on the calling thread
+    static const size_t PARALLEL_INGEST_BYTES = 4 * 1024 * 1024;
+
+public:
+    static constexpr const char* DEFAULT_CSV = "expenses.csv";
+    
+    ExpenseTracker(const std::string& csvFileName = DEFAULT_CSV) 
+        : csvFile(csvFileName), journalFile(csvFileName + ".journal"),
+          manifestFile(csvFileName + ".manifest"), budgetFile(csvFileName + ".budget") {
+        loadFromCSV();  // Always load from CSV
+        replayJournal();
+        loadBudget();
+        writer = std::thread(&ExpenseTracker::writerLoop, this);
+    }
+    
+    ~ExpenseTracker() {
+        bool pending;
+        {
+            std::lock_guard<std::shared_mutex> lock(storeMutex);
+            pending = journalEntries > 0 || dirty;
+        }
+        if (pending) {
+            saveToCSV();  // Fold pending journal records into the CSV
+        }
+        
+        // Let the writer finish anything queued, then stop it
+        {
+            std::lock_guard<std::shared_mutex> lock(storeMutex);
+            stopWriter = true;
+        }
+        writerWake.notify_all();
+        writer.join();
+    }
+    
+    void addExpense(int64_t amount, const std::string& category, 
+                   const std::string& description, const Date& date = Date()) {
+        Metrics::Timer timer(Metrics::Add);
+        std::lock_guard<std::shared_mutex> lock(storeMutex);
+        requireYears(date.getYear(), date.getYear());
+        uint32_t categoryId = CategoryDictionary::global().intern(category);
+        size_t slot = expenses.append(Expense::allocateId(), amount, date.toPacked(), categoryId, description);
+        std::cout << "Expense added successfully!\n";
+        
+        // Record the mutation instead of rewriting the whole CSV
+        appendJournal("A," + std::to_string(expenses.id(slot)) + "," +
+                      formatDateForCSV(date) + "," +
+                      quoteCSVField(category) + "," +
+                      quoteCSVField(description) + "," +
+                      Money::format(amount));
+        
+        checkBudgetWarning(date.toPacked(), categoryId);
+    }
+    
+    void removeExpenseById(int id) {
+        Metrics::Timer timer(Metrics::Remove);
+        std::lock_guard<std::shared_mutex> lock(storeMutex);
+        size_t slot = locate(id);
+        
+        if (slot != ExpenseStore::npos) {
+            expenses.erase(slot);
+            std::cout << "Expense removed successfully!\n";
+            
+            appendJournal("R," + std::to_string(id));
+        } else {
+            std::cout << "Expense with ID " << id << " not found!\n";
+        }
+    }
+    
+    void editExpenseById(int id) {
+        size_t slot;
+        {
+            std::lock_guard<std::shared_mutex> lock(storeMutex);
+            slot = locate(id);
+        }
+        
+        if (slot != ExpenseStore::npos) {
+            editExpenseHelper(slot);
+        } else {
+            std::cout << "Expense with ID " << id << " not found!\n";
+        }
+    }
+    
+    void editExpenseInteractive() {
+        loadAllYears();
+        if (expenses.empty()) {
+            std::cout << "No expenses recorded.\n";
+            return;
+        }
+        
+        std::cout << "\n=== FIND EXPENSE TO EDIT ===\n";
+        std::cout << "1. Search by keyword and select\n";
+        std::cout << "2. Browse recent expenses\n";
+        std::cout << "3. Browse by category\n";
+        std::cout << "4. Enter expense ID directly\n";
+        std::cout << "Choose search method: ";
+        
+        int choice;
+        std::cin >> choice;
+        
+        switch (choice) {
+            case 1:
+                findAndEditByKeyword();
+                break;
+            case 2:
+                findAndEditRecent();
+                break;
+            case 3:
+                findAndEditByCategory();
+                break;
+            case 4: {
+                int id;
+                std::cout << "Enter expense ID: ";
+                std::cin >> id;
+                editExpenseById(id);
+                break;
+            }
+            default:
+                std::cout << "Invalid choice.\n";
+        }
+    }
+    
+    void removeExpenseInteractive() {
+        loadAllYears();
+        if (expenses.empty()) {
+            std::cout << "No expenses recorded.\n";
+            return;
+        }
+        
+        std::cout << "\n=== FIND EXPENSE TO REMOVE ===\n";
         std::cout << "1. Search by keyword and select\n";
         std::cout << "2. Browse recent expenses\n";
         std::cout << "3. Browse by category\n";
         std::cout << "4. Enter expense ID directly\n";
         std::cout << "Choose search method: ";
         
-        int choice;
-        std::cin >> choice;
+        int choice;
+        std::cin >> choice;
+        
+        switch (choice) {
+            case 1:
+                findAndRemoveByKeyword();
+                break;
+            case 2:
+                findAndRemoveRecent();
+                break;
+            case 3:
+                findAndRemoveByCategory();
+                break;
+            case 4: {
+                int id;
+                std::cout << "Enter expense ID: ";
+                std::cin >> id;
+                removeExpenseById(id);
+                break;
+            }
+            default:
+                std::cout << "Invalid choice.\n";
+        }
+    }
+    
+    void viewAllExpenses() {
+        std::vector<Expense> all = ledgerMatches(ExpenseQuery());
+        if (all.empty()) {
+            std::cout << "No expenses recorded.\n";
+            return;
+        }
+        
+        int64_t total = 0;
+        std::cout << "\n=== ALL EXPENSES ===\n";
+        for (const Expense& expense : all) {
+            std::cout << expense.toString() << "\n";
+            total += expense.getAmount();
+        }
+        
+        std::cout << "\nTotal Expenses: " << Money::format(total) << "\n";
+    }
+    
+    void viewExpensesByCategory() {
+        Metrics::Timer timer(Metrics::Report);
+        
+        CategoryTotals totals = ledgerCategoryTotals();
+        if (totals.rows == 0) {
+            std::cout << "No expenses recorded.\n";
+            return;
+        }
+        
+        const CategoryDictionary& dictionary = CategoryDictionary::global();
+        std::cout << "\n=== EXPENSES BY CATEGORY ===\n";
+        for (uint32_t id : dictionary.sortedIds()) {
+            if (totals.count(id) == 0) continue;
+            std::cout << dictionary.name(id) << ": " << Money::format(totals.amount(id)) << "\n";
+        }
+    }
+    
+    void viewMonthlyReport(int month, int year) {
+        Metrics::Timer timer(Metrics::Report);
+        
+        std::cout << "Total expenses in database: " << loadYears(year, year) << "\n";
+        
+        // Only the month's partition of the date index is touched
+        std::vector<size_t> monthlyExpenses;
+        if (month >= 1 && month <= 12 && year >= 0) {
+            // Day 31 packs past every real day of the month
+            expenses.select(ExpenseQuery().between(Date(1, month, year), Date(31, month, year)), monthlyExpenses);
+        }
+        
+        if (monthlyExpenses.empty()) {
+            std::cout << "No expenses found for " << month << "/" << year << "\n";
+            std::cout << "Available months/years in data:\n";
+            
+            // Show available dates for debugging
+            loadAllYears();
+            std::vector<std::pair<int, int>> availableDates = expenses.availableMonths();
+            std::sort(availableDates.begin(), availableDates.end());
+            
+            for (const auto& date : availableDates) {
+                std::cout << "  " << date.first << "/" << date.second << "\n";
+            }
+            return;
+        }
+        
+        std::cout << "\n=== MONTHLY REPORT (" << month << "/" << year << ") ===\n";
+        for (size_t slot : monthlyExpenses) {
+            std::cout << expenses.at(slot).toString() << "\n";
+        }
+        
+        // Total and category breakdown come from the month's running totals
+        const CategoryTotals& totals = *expenses.monthTotals(month, year);
+        std::cout << "\nTotal for " << month << "/" << year << ": " 
+                 << Money::format(totals.total) << "\n";
+        
+        const CategoryDictionary& dictionary = CategoryDictionary::global();
+        std::cout << "\nCategory Breakdown:\n";
+        for (uint32_t id : dictionary.sortedIds()) {
+            if (totals.count(id) == 0) continue;
+            std::cout << "  " << dictionary.name(id) << ": " << Money::format(totals.amount(id)) << "\n";
+        }
+    }
+    
+    
+    // Ids of expenses dated between from and to inclusive, ordered by date
+    std::vector<int> findIdsBetween(const Date& from, const Date& to) {
+        loadYears(from.getYear(), to.getYear());
+        std::vector<int> ids;
+        for (size_t slot : slotsBetween(from, to)) {
+            ids.push_back(expenses.id(slot));
+        }
+        return ids;
+    }
+    
+    void viewDateRange(const std::string& fromText, const std::string& toText) {
+        Metrics::Timer timer(Metrics::Report);
+        
+        Date from, to;
+        try {
+            from = parseDate(fromText);
+            to = parseDate(toText);
+        } catch (const std::exception& e) {
+            std::cout << "Error: " << e.what() << " (expected DD-MM-YYYY)\n";
+            return;
+        }
+        
+        loadYears(from.getYear(), to.getYear());
+        std::vector<size_t> rangeExpenses = slotsBetween(from, to);
+        if (rangeExpenses.empty()) {
+            std::cout << "No expenses found between " << from.toString() << " and " << to.toString() << "\n";
+            return;
+        }
+        
+        std::cout << "\n=== EXPENSES FROM " << from.toString() << " TO " << to.toString() << " ===\n";
+        for (size_t slot : rangeExpenses) {
+            std::cout << expenses.at(slot).toString() << "\n";
+        }
+        
+        std::cout << "\nTotal for range: " << Money::format(expenses.dailyTotals().total(from.toPacked(), to.toPacked())) << "\n";
+    }
+    
+    // Ids of expenses whose category or description contains keyword
+    std::vector<int> findIdsByKeyword(const std::string& keyword) {
+        Metrics::Timer timer(Metrics::Search);
+        std::vector<int> ids;
+        for (const Expense& expense : ledgerMatches(ExpenseQuery().containing(keyword))) {
+            ids.push_back(expense.getId());
+        }
+        return ids;
+    }
+    
+    void searchExpenses(const std::string& keyword) {
+        std::vector<Expense> results;
+        {
+            Metrics::Timer timer(Metrics::Search);
+            results = ledgerMatches(ExpenseQuery().containing(keyword));
+        }
+        
+        if (results.empty()) {
+            std::cout << "No expenses found containing '" << keyword << "'\n";
+            return;
+        }
+        
+        std::cout << "\n=== SEARCH RESULTS for '" << keyword << "' ===\n";
+        for (const Expense& expense : results) {
+            std::cout << expense.toString() << "\n";
+        }
+    }
+    
+    void getTopCategories(int limit = 5) {
+        Metrics::Timer timer(Metrics::Report);
+        
+        CategoryTotals totals = ledgerCategoryTotals();
+        const CategoryDictionary& dictionary = CategoryDictionary::global();
+        std::vector<std::pair<uint32_t, int64_t>> sortedCategories;
+        for (uint32_t id : dictionary.sortedIds()) {
+            if (totals.count(id) > 0) sortedCategories.push_back({id, totals.amount(id)});
+        }
+        
+        // Only the first limit places are ordered; ties stay alphabetical
+        auto top = sortedCategories.begin() + std::min<size_t>(std::max(limit, 0), sortedCategories.size());
+        std::partial_sort(sortedCategories.begin(), top, sortedCategories.end(),
+            [&](const auto& a, const auto& b) {
+                return a.second > b.second || (a.second == b.second && dictionary.name(a.first) < dictionary.name(b.first));
+            });
+        
+        std::cout << "\n=== TOP " << limit << " SPENDING CATEGORIES ===\n";
+        int count = 0;
+        for (auto it = sortedCategories.begin(); it != top; ++it) {
+            const auto& pair = *it;
+            std::cout << ++count << ". " << dictionary.name(pair.first) << ": " 
+                     << Money::format(pair.second) << "\n";
+        }
+    }
+    
+    void exportExpenses() {
+        std::string format, filename;
+        std::cout << "Enter format (csv, jsonl or columnar): ";
+        std::cin >> format;
+        std::cout << "Enter file to write: ";
+        std::cin.ignore();
+        getline(std::cin, filename);
+        
+        try {
+            std::shared_lock<std::shared_mutex> lock(storeMutex);
+            uint64_t bytes = 0;
+            size_t rows = exportRows(expenses, partitions, ExpenseQuery(), format, filename, bytes);
+            std::cout << "Exported " << rows << " expenses to '" << filename << "' (" << bytes << " bytes)\n";
+        } catch (const std::exception& e) {
+            std::cout << "Error: " << e.what() << "\n";
+        }
+    }
+    
+    void manageBudgets() {
+        std::vector<Budget::Status> current;
+        {
+            std::lock_guard<std::shared_mutex> lock(storeMutex);
+            current = currentBudgetStatus();
+        }
+        
+        std::cout << "\n=== BUDGETS ===\n";
+        if (current.empty()) std::cout << "No budget limits set.\n";
+        for (size_t i = 0; i < current.size(); ++i) {
+            std::cout << (i + 1) << ". " << budgetLine(current[i]) << "\n";
+        }
+        
+        std::cout << "\n1. Set a limit\n";
+        std::cout << "2. Remove a limit\n";
+        std::cout << "3. Back\n";
+        std::cout << "Choose an option: ";
+        int choice;
+        std::cin >> choice;
+        
+        if (choice == 1) {
+            std::string category, periodName, amountText;
+            Budget::Period period;
+            int64_t amount = 0;
+            std::cout << "Enter category (* for all spending): ";
+            std::cin.ignore();
+            getline(std::cin, category);
+            std::cout << "Enter period (week, month or year): ";
+            std::cin >> periodName;
+            if (!DailyTotals::parsePeriod(periodName, period)) {
+                std::cout << "Invalid period.\n";
+                return;
+            }
+            std::cout << "Enter limit: ";
+            std::cin >> amountText;
+            if (!Money::parse(amountText, amount) || amount <= 0) {
+                std::cout << "Invalid amount.\n";
+                return;
+            }
+            
+            std::lock_guard<std::shared_mutex> lock(storeMutex);
+            budget.set(category == "*" ? DailyTotals::ALL : CategoryDictionary::global().intern(category),
+                       period, amount);
+            if (saveBudget()) {
+                std::cout << "Budget limit saved.\n";
+            } else {
+                std::cout << "Error: Could not save budget file '" << budgetFile << "'\n";
+            }
+        } else if (choice == 2) {
+            if (current.empty()) return;
+            std::cout << "Choose limit to remove (1-" << current.size() << "): ";
+            size_t index = 0;
+            std::cin >> index;
+            if (index < 1 || index > current.size()) {
+                std::cout << "Invalid choice.\n";
+                return;
+            }
+            
+            std::lock_guard<std::shared_mutex> lock(storeMutex);
+            const Budget::Limit& limit = current[index - 1].limit;
+            budget.set(limit.category, limit.period, 0);
+            if (saveBudget()) {
+                std::cout << "Budget limit removed.\n";
+            } else {
+                std::cout << "Error: Could not save budget file '" << budgetFile << "'\n";
+            }
+        }
+    }
+    
+    void importFromCSV(const std::string& filename) {
+        Metrics::Timer timer(Metrics::Import);
+        
+        // If importing from the main CSV file, just reload
+        if (filename == csvFile) {
+            std::unique_lock<std::shared_mutex> lock = lockWhenIdle();
+            expenses.clear();
+            loadFromCSV();
+            replayJournal();
+            std::cout << "Reloaded " << ledgerSize() << " expenses from " << filename << "\n";
+            return;
+        }
+        
+        // Otherwise, merge data from another CSV file
+        MappedFile file(filename);
+        if (!file.isOpen()) {
+            std::cout << "Error: Could not open file '" << filename << "'\n";
+            return;
+        }
+        
+        std::string_view text = file.view();
+        std::string_view line;
+        size_t pos = 0;
+        int importedCount = 0;
+        size_t total = 0;
+        int lineNumber = 0;
+        bool idColumn = false;
+        
+        // Skip header line
+        if (nextCSVLine(text, pos, line)) {
+            lineNumber++;
+            idColumn = hasIdColumn(line);
+            std::cout << "Skipping header: " << line << "\n";
+        }
+        
+        // Budgets are checked once for every period the new rows touched
+        std::vector<Budget::Status> warnings;
+        {
+            std::lock_guard<std::shared_mutex> lock(storeMutex);
+            std::set<Budget::PeriodKey> touched;
+            importedCount = static_cast<int>(ingestCSVText(text.substr(std::min(pos, text.size())),
+                                                           lineNumber, idColumn, true, &touched));
+            if (importedCount > 0) dirty = true;
+            total = ledgerSize();
+            warnings = budgetStatus(touched);
+        }
+        
+        std::cout << "Successfully imported " << importedCount << " additional expenses from '" << filename << "'\n";
+        if (!warnings.empty()) {
+            size_t exceeded = std::count_if(warnings.begin(), warnings.end(),
+                                            [](const Budget::Status& status) { return status.exceeded(); });
+            std::cout << "Budget check: " << exceeded << " over budget, " << (warnings.size() - exceeded)
+                      << " near the limit\n";
+            for (const Budget::Status& status : warnings) {
+                std::cout << "  " << budgetLine(status) << "\n";
+            }
+        }
+        
+        // Save the merged data to main CSV
+        if (importedCount > 0) {
+            saveToCSV();
+            std::cout << "Updated main CSV file with " << total << " total expenses\n";
+        }
+    }
+    
+    static std::string socketFile(const std::string& csv) { return csv + ".sock"; }
+    
+    // Run one command for a server client and write its JSON reply to out.
+    // Each command is its own transaction, and mutations are journaled like
+    // menu edits under the exclusive lock. Reads run on a pinned snapshot
+    // without holding any lock, so a long report neither blocks writers
+    // nor sees their changes halfway.
+    void serveCommand(const std::string& line, std::ostream& out) {
+        std::vector<std::string> fields = splitCSVLine(line);
+        std::ostringstream reply;
+        try {
+            BatchRead read;
+            if (batchRead(fields, read)) {
+                std::shared_ptr<const LedgerSnapshot> view = pinSnapshot(read);
+                readBatchCommand(view->store, view->partitions, fields, reply);
+            } else {
+                std::lock_guard<std::shared_mutex> lock(storeMutex);
+                applyBatchCommand(fields, reply, true);
+            }
+        } catch (const std::exception& e) {
+            reply.str("");
+            reply << "{\"op\":" << jsonString(fields[0]) << ",\"ok\":false,\"error\":" << jsonString(e.what()) << "}\n";
+        }
+        out << reply.str();
+    }
+    
+    // Apply a stream of commands as one transaction, writing one JSON object
+    // per command to out. Mutations skip the journal; the CSV is written
+    // once at the end, and only if every command succeeded. Returns the
+    // process exit status.
+    //   add,<amount>,<category>,<description>[,<DD-MM-YYYY>]
+    //   edit,<id>,<amount>,<category>,<description>
+    //   remove,<id>
+    //   search,<keyword>
+    //   report[,<month>,<year>]
+    //   stats[,<month>,<year>]
+    //   total,<from>,<to>[,<category>]
+    //   rollup,<week|month|year>,<from>,<to>[,<category>]
+    //   query[,<key>=<value>]...  (see runQuery)
+    //   export,<csv|jsonl|columnar>,<file>[,<key>=<value>]...  (query filters)
+    int runBatch(std::istream& in, std::ostream& out) {
+        auto started = std::chrono::steady_clock::now();
+        std::string line;
+        int lineNumber = 0;
+        size_t operations = 0;
+        size_t mutations = 0;
+        
+        while (getline(in, line)) {
+            lineNumber++;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty() || line[0] == '#') continue;
+            
+            std::vector<std::string> fields = splitCSVLine(line);
+            try {
+                std::lock_guard<std::shared_mutex> lock(storeMutex);
+                if (applyBatchCommand(fields, out)) {
+                    mutations++;
+                    dirty = true;
+                }
+                operations++;
+            } catch (const std::exception& e) {
+                out << "{\"op\":" << jsonString(fields[0]) << ",\"ok\":false,\"line\":" << lineNumber
+                    << ",\"error\":" << jsonString(e.what()) << "}\n";
+                rollbackBatch(out, operations);
+                return 1;
+            }
+        }
+        
+        // Single flush for the whole batch
+        if (mutations > 0 && !saveToCSV()) {
+            out << "{\"op\":\"commit\",\"ok\":false,\"error\":\"Could not save " << jsonEscape(csvFile) << "\"}\n";
+            rollbackBatch(out, operations);
+            return 1;
+        }
+        if (budgetDirty && !saveBudget()) {
+            out << "{\"op\":\"commit\",\"ok\":false,\"error\":\"Could not save " << jsonEscape(budgetFile) << "\"}\n";
+            rollbackBatch(out, operations);
+            return 1;
+        }
+        
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - started).count();
+        out << "{\"op\":\"commit\",\"ok\":true,\"operations\":" << operations
+            << ",\"elapsed_us\":" << elapsed << "}\n";
+        return 0;
+    }
+
+private:
+    // Live slots dated between from and to inclusive, ordered by date
+    std::vector<size_t> slotsBetween(const Date& from, const Date& to) const {
+        std::vector<size_t> result;
+        expenses.select(ExpenseQuery().between(from, to), result);
+        const SharedColumn<uint32_t>& dates = expenses.dateColumn();
+        std::stable_sort(result.begin(), result.end(),
+            [&dates](size_t a, size_t b) { return dates[a] < dates[b]; });
+        return result;
+    }
+    
+    // Slots whose category or description contains keyword
+    std::vector<size_t> findByKeyword(const std::string& keyword) const {
+        return findByKeyword(expenses, keyword);
+    }
+    
+    static std::vector<size_t> findByKeyword(const ExpenseStore& store, const std::string& keyword) {
+        Metrics::Timer timer(Metrics::Search);
+        std::vector<size_t> matches;
+        store.select(ExpenseQuery().containing(keyword), matches);
+        return matches;
+    }
+    
+    // The ten most recently added expenses, newest first
+    std::vector<size_t> recentSlots() const {
+        std::vector<size_t> sortedExpenses;
+        sortedExpenses.reserve(expenses.size());
+        for (size_t slot = 0; slot < expenses.slotCount(); ++slot) {
+            if (expenses.isLive(slot)) sortedExpenses.push_back(slot);
+        }
+        
+        const SharedColumn<int>& ids = expenses.idColumn();
+        size_t limit = std::min<size_t>(10, sortedExpenses.size());
+        std::partial_sort(sortedExpenses.begin(), sortedExpenses.begin() + limit, sortedExpenses.end(),
+            [&ids](size_t a, size_t b) { return ids[a] > ids[b]; });
+        sortedExpenses.resize(limit);
+        return sortedExpenses;
+    }
+    
+    // Prompt for one of the known categories and return its slots
+    bool chooseCategorySlots(std::vector<size_t>& categoryExpenses) const {
+        const CategoryDictionary& dictionary = CategoryDictionary::global();
+        std::vector<char> present(dictionary.size());
+        for (size_t slot = 0; slot < expenses.slotCount(); ++slot) {
+            if (expenses.isLive(slot)) present[expenses.categoryId(slot)] = 1;
+        }
+        
+        std::vector<uint32_t> categoryList;
+        for (uint32_t id : dictionary.sortedIds()) {
+            if (present[id]) categoryList.push_back(id);
+        }
+        
+        if (categoryList.empty()) {
+            std::cout << "No categories found.\n";
+            return false;
+        }
+        
+        std::cout << "\n=== SELECT CATEGORY ===\n";
+        
+        for (size_t i = 0; i < categoryList.size(); ++i) {
+            std::cout << (i + 1) << ". " << dictionary.name(categoryList[i]) << "\n";
+        }
+        
+        std::cout << "Choose category: ";
+        int choice;
+        std::cin >> choice;
+        
+        if (choice < 1 || choice > (int)categoryList.size()) {
+            std::cout << "Invalid choice.\n";
+            return false;
+        }
+        
+        expenses.select(ExpenseQuery().inCategory(dictionary.name(categoryList[choice - 1])), categoryExpenses);
+        return true;
+    }
+    
+    void editExpenseHelper(size_t slot) {
+        std::cout << "\nCurrent expense: " << expenses.at(slot).toString() << "\n\n";
+        
+        std::string amountText, category, description;
+        int64_t amount = 0;
+        
+        std::cout << "Enter new amount (current: " << Money::format(expenses.amount(slot)) << "): ";
+        std::cin >> amountText;
+        if (!Money::parse(amountText, amount)) {
+            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            std::cout << "Invalid amount. Expense not changed.\n";
+            return;
+        }
+        
+        std::cout << "Enter new category (current: " << expenses.category(slot) << "): ";
+        std::cin.ignore();
+        getline(std::cin, category);
+        
+        std::cout << "Enter new description (current: " << expenses.description(slot) << "): ";
+        getline(std::cin, description);
+        
+        // Time the update itself, not the prompts
+        Metrics::Timer timer(Metrics::Edit);
+        std::lock_guard<std::shared_mutex> lock(storeMutex);
+        expenses.setAmount(slot, amount);
+        expenses.setCategory(slot, category);
+        expenses.setDescription(slot, description);
+        
+        std::cout << "Expense updated successfully!\n";
+        
+        appendJournal("E," + std::to_string(expenses.id(slot)) + "," +
+                      Money::format(amount) + "," +
+                      quoteCSVField(category) + "," +
+                      quoteCSVField(description));
+        checkBudgetWarning(expenses.date(slot), expenses.categoryId(slot));
+    }
+    
+    void findAndEditByKeyword() {
+        std::string keyword;
+        std::cout << "Enter search keyword (category or description): ";
+        std::cin.ignore();
+        getline(std::cin, keyword);
+        
+        std::vector<size_t> matches = findByKeyword(keyword);
+        
+        if (matches.empty()) {
+            std::cout << "No expenses found containing '" << keyword << "'\n";
+            return;
+        }
+        
+        selectAndEditFromList(matches);
+    }
+    
+    void findAndEditRecent() {
+        std::cout << "\n=== RECENT EXPENSES ===\n";
+        selectAndEditFromList(recentSlots());
+    }
+    
+    void findAndEditByCategory() {
+        std::vector<size_t> categoryExpenses;
+        if (chooseCategorySlots(categoryExpenses)) {
+            selectAndEditFromList(categoryExpenses);
+        }
+    }
+    
+    void selectAndEditFromList(const std::vector<size_t>& expenseList) {
+        if (expenseList.empty()) {
+            std::cout << "No expenses to display.\n";
+            return;
+        }
+        
+        std::cout << "\n=== SELECT EXPENSE TO EDIT ===\n";
+        for (size_t i = 0; i < expenseList.size(); ++i) {
+            std::cout << (i + 1) << ". " << expenses.at(expenseList[i]).toString() << "\n";
+        }
+        
+        std::cout << "\nChoose expense to edit (1-" << expenseList.size() << "): ";
+        int choice;
+        std::cin >> choice;
+        
+        if (choice < 1 || choice > (int)expenseList.size()) {
+            std::cout << "Invalid choice.\n";
+            return;
+        }
+        
+        editExpenseHelper(expenseList[choice - 1]);
+    }
+    
+    void findAndRemoveByKeyword() {
+        std::string keyword;
+        std::cout << "Enter search keyword (category or description): ";
+        std::cin.ignore();
+        getline(std::cin, keyword);
+        
+        std::vector<size_t> matches = findByKeyword(keyword);
+        
+        if (matches.empty()) {
+            std::cout << "No expenses found containing '" << keyword << "'\n";
+            return;
+        }
+        
+        selectAndRemoveFromList(matches);
+    }
+    
+    void findAndRemoveRecent() {
+        std::cout << "\n=== RECENT EXPENSES ===\n";
+        selectAndRemoveFromList(recentSlots());
+    }
+    
+    void findAndRemoveByCategory() {
+        std::vector<size_t> categoryExpenses;
+        if (chooseCategorySlots(categoryExpenses)) {
+            selectAndRemoveFromList(categoryExpenses);
+        }
+    }
+    
+    void selectAndRemoveFromList(const std::vector<size_t>& expenseList) {
+        if (expenseList.empty()) {
+            std::cout << "No expenses to display.\n";
+            return;
+        }
+        
+        std::cout << "\n=== SELECT EXPENSE TO REMOVE ===\n";
+        for (size_t i = 0; i < expenseList.size(); ++i) {
+            std::cout << (i + 1) << ". " << expenses.at(expenseList[i]).toString() << "\n";
+        }
+        
+        std::cout << "\nChoose expense to remove (1-" << expenseList.size() << "): ";
+        int choice;
+        std::cin >> choice;
+        
+        if (choice < 1 || choice > (int)expenseList.size()) {
+            std::cout << "Invalid choice.\n";
+            return;
+        }
+        
+        int selectedId = expenses.id(expenseList[choice - 1]);
+        
+        std::cout << "\nAre you sure you want to remove this expense? (y/n): ";
+        char confirm;
+        std::cin >> confirm;
+        
+        if (confirm == 'y' || confirm == 'Y') {
+            removeExpenseById(selectedId);
+        } else {
+            std::cout << "Removal cancelled.\n";
+        }
+    }
+    
+    // Returns true if the command changed the ledger; throws on bad input.
+    // Read-only commands page in the years they need first. Mutations are
+    // journaled when journaled is set; batches save once at the end instead.
+    bool applyBatchCommand(const std::vector<std::string>& fields, std::ostream& out, bool journaled = false) {
+        const std::string& op = fields[0];
+        
+        BatchRead read;
+        if (batchRead(fields, read)) {
+            if (!read.readsColdFiles && read.firstYear <= read.lastYear) {
+                requireYears(read.firstYear, read.lastYear);
+            }
+            if (read.sketches) expenses.refreshSketches();
+            readBatchCommand(expenses, partitions, fields, out);
+            return false;
+        }
+        
+        if (op == "add" && (fields.size() == 4 || fields.size() == 5)) {
+            Metrics::Timer timer(Metrics::Add);
+            int64_t amount = parseBatchAmount(fields[1]);
+            Date date = fields.size() == 5 ? parseDate(fields[4]) : Date();
+            int id = Expense::allocateId();
+            requireYears(date.getYear(), date.getYear());
+            uint32_t category = CategoryDictionary::global().intern(fields[2]);
+            expenses.append(id, amount, date.toPacked(), category, fields[3]);
+            if (journaled) {
+                appendJournal("A," + std::to_string(id) + "," + formatDateForCSV(date) + "," +
+                              quoteCSVField(fields[2]) + "," + quoteCSVField(fields[3]) + "," + Money::format(amount));
+            }
+            out << "{\"op\":\"add\",\"ok\":true,\"id\":" << id;
+            writeBudgetWarnings(date.toPacked(), category, out);
+            out << "}\n";
+            return true;
+        }
+        
+        if (op == "edit" && fields.size() == 5) {
+            Metrics::Timer timer(Metrics::Edit);
+            size_t slot = batchSlot(fields[1]);
+            int64_t amount = parseBatchAmount(fields[2]);
+            expenses.setAmount(slot, amount);
+            expenses.setCategory(slot, fields[3]);
+            expenses.setDescription(slot, fields[4]);
+            if (journaled) {
+                appendJournal("E," + std::to_string(expenses.id(slot)) + "," + Money::format(amount) + "," +
+                              quoteCSVField(fields[3]) + "," + quoteCSVField(fields[4]));
+            }
+            out << "{\"op\":\"edit\",\"ok\":true,\"id\":" << expenses.id(slot);
+            writeBudgetWarnings(expenses.date(slot), expenses.categoryId(slot), out);
+            out << "}\n";
+            return true;
+        }
+        
+        if (op == "remove" && fields.size() == 2) {
+            Metrics::Timer timer(Metrics::Remove);
+            size_t slot = batchSlot(fields[1]);
+            int id = expenses.id(slot);
+            expenses.erase(slot);
+            if (journaled) appendJournal("R," + std::to_string(id));
+            out << "{\"op\":\"remove\",\"ok\":true,\"id\":" << id << "}\n";
+            return true;
+        }
+        
+        if (op == "budget" && fields.size() == 1) {
+            out << "{\"op\":\"budget\",\"ok\":true,\"limits\":[";
+            writeBudgetStatus(currentBudgetStatus(), out);
+            out << "]}\n";
+            return false;
+        }
+        
+        if (op == "budget" && fields.size() == 4) {
+            Budget::Period period;
+            if (!DailyTotals::parsePeriod(fields[2], period)) {
+                throw std::runtime_error("Period must be week, month or year");
+            }
+            int64_t amount = parseAmount(fields[3]);
+            if (amount < 0) throw std::runtime_error("Limit must not be negative");
+            uint32_t category = fields[1] == "*" ? DailyTotals::ALL : CategoryDictionary::global().intern(fields[1]);
+            if (!budget.set(category, period, amount)) throw std::runtime_error("No such budget limit");
+            if (!journaled) {
+                budgetDirty = true;
+            } else if (!saveBudget()) {
+                throw std::runtime_error("Could not save budget file '" + budgetFile + "'");
+            }
+            out << "{\"op\":\"budget\",\"ok\":true,\"category\":" << jsonString(fields[1])
+                << ",\"period\":\"" << Budget::periodName(period) << "\",\"limit\":" << Money::format(amount) << "}\n";
+            return false;
+        }
+        
+        throw std::runtime_error("Unknown command or wrong number of fields");
+    }
+    
+    // Read budgetFile: a header, then one line per limit of category (* for
+    // all spending), period and amount. Malformed lines are reported and
+    // skipped.
+    void loadBudget() {
+        budget.clear();
+        std::ifstream file(budgetFile);
+        if (!file.is_open()) return;
+        
+        std::string line;
+        int lineNumber = 0;
+        while (getline(file, line)) {
+            lineNumber++;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (lineNumber == 1 || line.empty()) continue;
+            try {
+                std::vector<std::string> fields = splitCSVLine(line);
+                Budget::Period period;
+                if (fields.size() != 3 || !DailyTotals::parsePeriod(fields[1], period)) {
+                    throw std::runtime_error("Expected category, week|month|year and limit");
+                }
+                int64_t amount = parseAmount(fields[2]);
+                if (amount <= 0) throw std::runtime_error("Limit must be positive");
+                budget.set(fields[0] == "*" ? DailyTotals::ALL : CategoryDictionary::global().intern(fields[0]),
+                           period, amount);
+            } catch (const std::exception& e) {
+                std::cout << "Error parsing budget line " << lineNumber << ": " << e.what() << "\n";
+            }
+        }
+    }
+    
+    // Replaced atomically, like the CSV
+    bool saveBudget() {
+        std::string tempFile = budgetFile + ".tmp";
+        {
+            std::ofstream file(tempFile);
+            if (!file.is_open()) return false;
+            file << "Category,Period,Limit\n";
+            for (const Budget::Limit& limit : budget.limits()) {
+                file << budgetCategory(limit) << "," << Budget::periodName(limit.period) << ","
+                     << Money::format(limit.amount) << "\n";
+            }
+            if (!file) return false;
+        }
+        if (std::rename(tempFile.c_str(), budgetFile.c_str()) != 0) return false;
+        budgetDirty = false;
+        return true;
+    }
+    
+    static std::string budgetCategory(const Budget::Limit& limit) {
+        if (limit.category == DailyTotals::ALL) return "*";
+        return quoteCSVField(CategoryDictionary::global().name(limit.category));
+    }
+    
+    // Evaluate budget periods after paging in every year they cover. Caller
+    // holds storeMutex.
+    std::vector<Budget::Status> budgetStatus(const std::set<Budget::PeriodKey>& periods, bool warningsOnly = true) {
+        for (const Budget::PeriodKey& key : periods) {
+            Budget::Period period = budget.limits()[key.first].period;
+            requireYears(ExpenseStore::yearOf(key.second),
+                         ExpenseStore::yearOf(Budget::periodEnd(key.second, period)));
+        }
+        return budget.evaluate(expenses.dailyTotals(), periods, warningsOnly);
+    }
+    
+    // Every limit's spending in the period that contains today. Caller
+    // holds storeMutex.
+    std::vector<Budget::Status> currentBudgetStatus() {
+        std::set<Budget::PeriodKey> periods;
+        uint32_t today = Date().toPacked();
+        for (size_t i = 0; i < budget.limits().size(); ++i) {
+            periods.emplace(i, Budget::periodStart(today, budget.limits()[i].period));
+        }
+        return budgetStatus(periods, false);
+    }
+    
+    // Warn about the limits an expense dated date in category brought near
+    // or over. Caller holds storeMutex.
+    void checkBudgetWarning(uint32_t date, uint32_t category) {
+        if (budget.empty()) return;
+        std::set<Budget::PeriodKey> periods;
+        budget.touch(date, category, periods);
+        for (const Budget::Status& status : budgetStatus(periods)) {
+            std::cout << "Budget warning: " << budgetLine(status) << "\n";
+        }
+    }
+    
+    static std::string budgetLine(const Budget::Status& status) {
+        std::string name = status.limit.category == DailyTotals::ALL
+            ? "All spending" : CategoryDictionary::global().name(status.limit.category);
+        return name + " " + Budget::periodName(status.limit.period) + " " +
+               formatDateForCSV(Date::fromPacked(status.first)) + " to " +
+               formatDateForCSV(Date::fromPacked(status.last)) + ": " + Money::format(status.spent) +
+               " of " + Money::format(status.limit.amount) + " (" + std::to_string(status.percent()) + "%)" +
+               (status.exceeded() ? ", over budget" : "");
+    }
+    
+    // JSON objects for statuses, comma separated
+    static void writeBudgetStatus(const std::vector<Budget::Status>& statuses, std::ostream& out) {
+        const char* separator = "";
+        for (const Budget::Status& status : statuses) {
+            out << separator << "{\"category\":"
+                << (status.limit.category == DailyTotals::ALL
+                        ? std::string("\"*\"") : jsonString(CategoryDictionary::global().name(status.limit.category)))
+                << ",\"period\":\"" << Budget::periodName(status.limit.period) << "\""
+                << ",\"from\":" << jsonString(formatDateForCSV(Date::fromPacked(status.first)))
+                << ",\"to\":" << jsonString(formatDateForCSV(Date::fromPacked(status.last)))
+                << ",\"limit\":" << Money::format(status.limit.amount)
+                << ",\"spent\":" << Money::format(status.spent)
+                << ",\"exceeded\":" << (status.exceeded() ? "true" : "false") << "}";
+            separator = ",";
+        }
+    }
+    
+    // A budget field for a batch reply, when the expense brought any limit
+    // near or over. Caller holds storeMutex.
+    void writeBudgetWarnings(uint32_t date, uint32_t category, std::ostream& out) {
+        if (budget.empty()) return;
+        std::set<Budget::PeriodKey> periods;
+        budget.touch(date, category, periods);
+        std::vector<Budget::Status> warnings = budgetStatus(periods);
+        if (warnings.empty()) return;
+        out << ",\"budget\":[";
+        writeBudgetStatus(warnings, out);
+        out << "]";
+    }
+    
+    // What a read-only batch command needs before it runs: its years
+    // resident, the keyword index built for searches and the sketches
+    // brought up to date for statistics
+    struct BatchRead {
+        int firstYear = 1;
+        int lastYear = 0;  // Empty unless first <= last
+        bool keywords = false;
+        bool sketches = false;
+        bool readsColdFiles = false;  // May read those years from partition files instead
+    };
+    
+    // Fill read and return true if fields is a read-only command
+    static bool batchRead(const std::vector<std::string>& fields, BatchRead& read) {
+        const std::string& op = fields[0];
+        if ((op == "search" && fields.size() == 2) || (op == "report" && fields.size() == 1)) {
+            read.firstYear = std::numeric_limits<int>::min();
+            read.lastYear = std::numeric_limits<int>::max();
+            read.keywords = op == "search";
+            return true;
+        }
+        if ((op == "report" || op == "stats") && fields.size() == 3) {
+            parseBatchInteger(fields[1], "Invalid month");
+            read.firstYear = read.lastYear = parseBatchInteger(fields[2], "Invalid year");
+            read.sketches = op == "stats";
+            return true;
+        }
+        if (op == "stats" && fields.size() == 1) {
+            read.firstYear = std::numeric_limits<int>::min();
+            read.lastYear = std::numeric_limits<int>::max();
+            read.sketches = true;
+            return true;
+        }
+        if ((op == "total" && (fields.size() == 3 || fields.size() == 4)) ||
+            (op == "rollup" && (fields.size() == 4 || fields.size() == 5))) {
+            size_t from = op == "total" ? 1 : 2;
+            read.firstYear = parseDate(fields[from]).getYear();
+            read.lastYear = parseDate(fields[from + 1]).getYear();
+            return true;
+        }
+        if (op == "export" && fields.size() >= 3) {
+            read.firstYear = std::numeric_limits<int>::min();
+            read.lastYear = std::numeric_limits<int>::max();
+            read.readsColdFiles = true;
+            for (size_t i = 3; i < fields.size(); ++i) {
+                if (fields[i].rfind("from=", 0) == 0) read.firstYear = parseDate(fields[i].substr(5)).getYear();
+                if (fields[i].rfind("to=", 0) == 0) read.lastYear = parseDate(fields[i].substr(3)).getYear();
+            }
+            return true;
+        }
+        if (op == "query") {
+            read.firstYear = std::numeric_limits<int>::min();
+            read.lastYear = std::numeric_limits<int>::max();
+            read.readsColdFiles = true;
+            for (size_t i = 1; i < fields.size(); ++i) {
+                if (fields[i].rfind("keyword=", 0) == 0) read.keywords = true;
+                if (fields[i].rfind("from=", 0) == 0) read.firstYear = parseDate(fields[i].substr(5)).getYear();
+                if (fields[i].rfind("to=", 0) == 0) read.lastYear = parseDate(fields[i].substr(3)).getYear();
+                if (fields[i].rfind("file=", 0) == 0) {
+                    // Reads another file, not the ledger
+                    read.firstYear = 1;
+                    read.lastYear = 0;
+                    read.keywords = false;
+                    break;
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+    
+    // Run a command batchRead accepted against store and its partition
+    // table: the live ledger, or a server snapshot. Only reads them.
+    void readBatchCommand(const ExpenseStore& store, const std::map<int, Partition>& years,
+                          const std::vector<std::string>& fields, std::ostream& out) const {
+        const std::string& op = fields[0];
+        
+        if (op == "search" && fields.size() == 2) {
+            out << "{\"op\":\"search\",\"ok\":true,\"ids\":[";
+            const char* separator = "";
+            for (size_t slot : findByKeyword(store, fields[1])) {
+                out << separator << store.id(slot);
+                separator = ",";
+            }
+            out << "]}\n";
+            return;
+        }
+        
+        if (op == "report" && (fields.size() == 1 || fields.size() == 3)) {
+            Metrics::Timer timer(Metrics::Report);
+            const CategoryTotals* totals = &store.ledgerTotals();
+            out << "{\"op\":\"report\",\"ok\":true";
+            if (fields.size() == 3) {
+                int month = parseBatchInteger(fields[1], "Invalid month");
+                int year = parseBatchInteger(fields[2], "Invalid year");
+                if (month < 1 || month > 12) throw std::runtime_error("Invalid month");
+                totals = store.monthTotals(month, year);
+                out << ",\"month\":" << month << ",\"year\":" << year;
+            }
+            
+            out << ",\"count\":" << (totals ? totals->rows : 0)
+                << ",\"total\":" << Money::format(totals ? totals->total : 0) << ",\"categories\":{";
+            const char* separator = "";
+            const CategoryDictionary& dictionary = CategoryDictionary::global();
+            for (uint32_t id : dictionary.sortedIds()) {
+                if (!totals || totals->count(id) == 0) continue;
+                out << separator << jsonString(dictionary.name(id)) << ":" << Money::format(totals->amount(id));
+                separator = ",";
+            }
+            out << "}}\n";
+            return;
+        }
+        
+        if (op == "stats" && (fields.size() == 1 || fields.size() == 3)) {
+            Metrics::Timer timer(Metrics::Report);
+            const LedgerSketches::Group* sketches = &store.ledgerSketches();
+            out << "{\"op\":\"stats\",\"ok\":true";
+            if (fields.size() == 3) {
+                int month = parseBatchInteger(fields[1], "Invalid month");
+                int year = parseBatchInteger(fields[2], "Invalid year");
+                if (month < 1 || month > 12) throw std::runtime_error("Invalid month");
+                sketches = store.monthSketches(month, year);
+                out << ",\"month\":" << month << ",\"year\":" << year;
+            }
+            
+            static const ExpenseSketch empty;
+            writeSketch(sketches ? sketches->all : empty, out);
+            out << ",\"categories\":{";
+            const char* separator = "";
+            const CategoryDictionary& dictionary = CategoryDictionary::global();
+            for (uint32_t id : dictionary.sortedIds()) {
+                if (!sketches || id >= sketches->byCategory.size() || sketches->byCategory[id].amounts.count() == 0) {
+                    continue;
+                }
+                out << separator << jsonString(dictionary.name(id)) << ":{";
+                writeSketch(sketches->byCategory[id], out, "");
+                out << "}";
+                separator = ",";
+            }
+            out << "}}\n";
+            return;
+        }
+        
+        if (op == "total" && (fields.size() == 3 || fields.size() == 4)) {
+            Metrics::Timer timer(Metrics::Report);
+            Date from = parseDate(fields[1]);
+            Date to = parseDate(fields[2]);
+            int64_t total = store.dailyTotals().total(from.toPacked(), to.toPacked(), batchCategory(fields, 3));
+            out << "{\"op\":\"total\",\"ok\":true,\"total\":" << Money::format(total) << "}\n";
+            return;
+        }
+        
+        if (op == "rollup" && (fields.size() == 4 || fields.size() == 5)) {
+            Metrics::Timer timer(Metrics::Report);
+            DailyTotals::Period period;
+            if (!DailyTotals::parsePeriod(fields[1], period)) {
+                throw std::runtime_error("Period must be week, month or year");
+            }
+            Date from = parseDate(fields[2]);
+            Date to = parseDate(fields[3]);
+            
+            out << "{\"op\":\"rollup\",\"ok\":true,\"period\":" << jsonString(fields[1]) << ",\"totals\":[";
+            const char* separator = "";
+            for (const auto& bucket : store.dailyTotals().rollup(from.toPacked(), to.toPacked(), period,
+                                                                    batchCategory(fields, 4))) {
+                out << separator << "{\"from\":" << jsonString(formatDateForCSV(Date::fromPacked(bucket.first)))
+                    << ",\"total\":" << Money::format(bucket.second) << "}";
+                separator = ",";
+            }
+            out << "]}\n";
+            return;
+        }
+        
+        if (op == "query") {
+            Metrics::Timer timer(Metrics::Search);
+            runQuery(store, years, fields, out);
+            return;
+        }
+        
+        if (op == "export" && fields.size() >= 3) {
+            ExpenseQuery query;
+            for (size_t i = 3; i < fields.size(); ++i) {
+                size_t equals = fields[i].find('=');
+                if (equals == std::string::npos ||
+                    !parseQueryFilter(fields[i].substr(0, equals), fields[i].substr(equals + 1), query)) {
+                    throw std::runtime_error("Unknown export field: " + fields[i]);
+                }
+            }
+            uint64_t bytes = 0;
+            size_t rows = exportRows(store, years, query, fields[1], fields[2], bytes);
+            out << "{\"op\":\"export\",\"ok\":true,\"format\":" << jsonString(fields[1])
+                << ",\"file\":" << jsonString(fields[2]) << ",\"rows\":" << rows << ",\"bytes\":" << bytes << "}\n";
+            return;
+        }
         
-        switch (choice) {
-            case 1:
-                findAndRemoveByKeyword();
-                break;
-            case 2:
-                findAndRemoveRecent();
-                break;
-            case 3:
-                findAndRemoveByCategory();
-                break;
-            case 4: {
-                int id;
-                std::cout << "Enter expense ID: ";
-                std::cin >> id;
-                removeExpenseById(id);
-                break;
+        throw std::runtime_error("Unknown command or wrong number of fields");
+    }
+    
+    // Count, estimated median, p90 and p99 amounts, and estimated distinct
+    // descriptions, as JSON fields after a leading separator
+    static void writeSketch(const ExpenseSketch& sketch, std::ostream& out, const char* separator = ",") {
+        out << separator << "\"count\":" << sketch.amounts.count()
+            << ",\"median\":" << Money::format(sketch.amounts.quantile(0.5))
+            << ",\"p90\":" << Money::format(sketch.amounts.quantile(0.9))
+            << ",\"p99\":" << Money::format(sketch.amounts.quantile(0.99))
+            << ",\"distinct_descriptions\":" << sketch.descriptions.estimate();
+    }
+    
+    // Matches collected by a batch query, keyed by id so rows from memory,
+    // partition files and external files come out in one order. Grouped
+    // queries keep only per-group counts, keyed by category name and
+    // monthKey so resident and on-disk rows land in the same groups.
+    struct QueryResult {
+        std::string select = "ids";  // ids, rows or totals
+        std::string group;  // Empty, category, month or category-month
+        std::vector<std::pair<int, std::string>> rows;
+        std::map<std::string, int64_t, std::less<>> categories;
+        std::map<std::pair<std::string, uint32_t>, ExpenseStore::Group> groups;
+        int64_t total = 0;
+        size_t count = 0;
+        
+        ExpenseStore::GroupBy groupBy() const {
+            if (group == "category") return ExpenseStore::GroupBy::Category;
+            return group == "month" ? ExpenseStore::GroupBy::Month : ExpenseStore::GroupBy::CategoryMonth;
+        }
+        
+        void addGroup(std::string_view category, uint32_t month, size_t rowCount, int64_t amount) {
+            count += rowCount;
+            total += amount;
+            ExpenseStore::GroupBy by = groupBy();
+            if (by == ExpenseStore::GroupBy::Month) category = std::string_view();
+            if (by == ExpenseStore::GroupBy::Category) month = 0;
+            ExpenseStore::Group& entry = groups[{std::string(category), month}];
+            entry.month = month;
+            entry.count += rowCount;
+            entry.total += amount;
+        }
+        
+        void add(int id, uint32_t date, std::string_view category, int64_t amount, std::string_view description) {
+            if (!group.empty()) {
+                addGroup(category, ExpenseStore::monthKey(date), 1, amount);
+                return;
+            }
+            count++;
+            total += amount;
+            auto it = categories.find(category);
+            if (it == categories.end()) it = categories.emplace(std::string(category), 0).first;
+            it->second += amount;
+            
+            if (select == "rows") {
+                rows.emplace_back(id, "{\"id\":" + std::to_string(id) + ",\"date\":" +
+                                      jsonString(formatDateForCSV(Date::fromPacked(date))) + ",\"category\":" +
+                                      jsonString(std::string(category)) + ",\"description\":" +
+                                      jsonString(std::string(description)) + ",\"amount\":" + Money::format(amount) + "}");
+            } else if (select == "ids") {
+                rows.emplace_back(id, std::to_string(id));
+            }
+        }
+    };
+    
+    // query[,from=<DD-MM-YYYY>][,to=<DD-MM-YYYY>][,category=<name>]...
+    //      [,min=<amount>][,max=<amount>][,keyword=<text>]
+    //      [,select=ids|rows|totals][,group=category|month|category-month]
+    //      [,top=<k>][,file=<csv>]
+    // Without file the whole ledger is queried: resident rows through
+    // ExpenseStore::select, or ExpenseStore::aggregate when grouping, and
+    // cold years straight from their partition files without paging them
+    // in. Caller holds storeMutex, shared or not.
+    void runQuery(const ExpenseStore& store, const std::map<int, Partition>& years,
+                  const std::vector<std::string>& fields, std::ostream& out) const {
+        ExpenseQuery query;
+        QueryResult result;
+        std::string path;
+        size_t top = std::numeric_limits<size_t>::max();
+        for (size_t i = 1; i < fields.size(); ++i) {
+            size_t equals = fields[i].find('=');
+            if (equals == std::string::npos) throw std::runtime_error("Expected key=value: " + fields[i]);
+            std::string key = fields[i].substr(0, equals);
+            std::string value = fields[i].substr(equals + 1);
+            
+            if (parseQueryFilter(key, value, query)) continue;
+            
+            if (key == "select" && (value == "ids" || value == "rows" || value == "totals")) {
+                result.select = value;
+            } else if (key == "group" && (value == "category" || value == "month" || value == "category-month")) {
+                result.group = value;
+            } else if (key == "top") {
+                int k = parseBatchInteger(value, "top must be a whole number");
+                if (k < 0) throw std::runtime_error("top must not be negative");
+                top = static_cast<size_t>(k);
+            } else if (key == "file") {
+                path = value;
+            } else {
+                throw std::runtime_error("Unknown query field: " + fields[i]);
+            }
+        }
+        
+        std::string plan;
+        size_t partitionsScanned = 0;
+        if (!path.empty()) {
+            plan = "file-scan";
+            queryCSVFile(path, query, result);
+        } else {
+            if (!result.group.empty()) {
+                ExpenseStore::QueryPlan used;
+                const CategoryDictionary& dictionary = CategoryDictionary::global();
+                for (const ExpenseStore::Group& group : store.aggregate(query, result.groupBy(), &used)) {
+                    result.addGroup(dictionary.name(group.category), group.month, group.count, group.total);
+                }
+                plan = ExpenseStore::planName(used);
+            } else {
+                std::vector<size_t> slots;
+                plan = ExpenseStore::planName(store.select(query, slots));
+                for (size_t slot : slots) {
+                    result.add(store.id(slot), store.date(slot), store.category(slot),
+                               store.amount(slot), store.description(slot));
+                }
+            }
+            
+            // Years outside the date range are never opened
+            int firstYear = ExpenseStore::yearOf(query.firstDate);
+            int lastYear = ExpenseStore::yearOf(query.lastDate);
+            for (const auto& entry : years) {
+                if (entry.second.resident || entry.first < firstYear || entry.first > lastYear) continue;
+                std::string file = partitionFile(csvFile, entry.first, entry.second.generation);
+                if (!queryPartitionFile(file, query, result)) {
+                    throw std::runtime_error("Could not read snapshot partition '" + file + "'");
+                }
+                partitionsScanned++;
+            }
+        }
+        
+        std::sort(result.rows.begin(), result.rows.end());
+        out << "{\"op\":\"query\",\"ok\":true,\"plan\":\"" << plan << "\"";
+        if (path.empty()) out << ",\"partitions_scanned\":" << partitionsScanned;
+        out << ",\"count\":" << result.count << ",\"total\":" << Money::format(result.total);
+        if (!result.group.empty()) {
+            writeGroups(result, top, out);
+            return;
+        }
+        out << ",\"categories\":{";
+        const char* separator = "";
+        for (const auto& category : result.categories) {
+            out << separator << jsonString(category.first) << ":" << Money::format(category.second);
+            separator = ",";
+        }
+        out << "}";
+        if (result.select != "totals") {
+            out << ",\"" << result.select << "\":[";
+            separator = "";
+            for (const auto& row : result.rows) {
+                out << separator << row.second;
+                separator = ",";
+            }
+            out << "]";
+        }
+        out << "}\n";
+    }
+    
+    // The k largest groups by total, largest first, with ties in key order.
+    // Only those k are sorted; the rest are just partitioned away.
+    static void writeGroups(const QueryResult& result, size_t k, std::ostream& out) {
+        using Entry = std::pair<std::pair<std::string, uint32_t>, ExpenseStore::Group>;
+        std::vector<Entry> groups(result.groups.begin(), result.groups.end());
+        auto top = groups.begin() + std::min(k, groups.size());
+        std::partial_sort(groups.begin(), top, groups.end(), [](const Entry& a, const Entry& b) {
+            return a.second.total > b.second.total || (a.second.total == b.second.total && a.first < b.first);
+        });
+        
+        ExpenseStore::GroupBy by = result.groupBy();
+        out << ",\"group\":\"" << result.group << "\",\"groups\":[";
+        const char* separator = "";
+        for (auto it = groups.begin(); it != top; ++it) {
+            out << separator << "{";
+            if (by != ExpenseStore::GroupBy::Month) {
+                out << "\"category\":" << jsonString(it->first.first) << ",";
+            }
+            if (by != ExpenseStore::GroupBy::Category) {
+                uint32_t month = it->first.second;
+                char buffer[16];
+                std::snprintf(buffer, sizeof(buffer), "%02u-%04u", month & 15, month >> 4);
+                out << "\"month\":\"" << buffer << "\",";
+            }
+            out << "\"count\":" << it->second.count << ",\"total\":" << Money::format(it->second.total) << "}";
+            separator = ",";
+        }
+        out << "]}\n";
+    }
+    
+    // Apply one of the row filters shared by query and export. Returns false
+    // if key is not a filter.
+    static bool parseQueryFilter(const std::string& key, const std::string& value, ExpenseQuery& query) {
+        if (key == "from") {
+            query.firstDate = parseDate(value).toPacked();
+        } else if (key == "to") {
+            query.lastDate = parseDate(value).toPacked();
+        } else if (key == "category") {
+            query.inCategory(value);
+        } else if (key == "min") {
+            query.minAmount = parseAmount(value);
+        } else if (key == "max") {
+            query.maxAmount = parseAmount(value);
+        } else if (key == "keyword") {
+            query.containing(value);
+        } else {
+            return false;
+        }
+        return true;
+    }
+    
+    // Add the rows of a partition file that match query to result
+    static bool queryPartitionFile(const std::string& path, const ExpenseQuery& query, QueryResult& result) {
+        return scanPartitionFile(path, query, [&result](int id, uint32_t date, std::string_view category,
+                                                        int64_t amount, std::string_view description) {
+            result.add(id, date, category, amount, description);
+        });
+    }
+    
+    // Scan a partition file's columns in place, calling visit for each row
+    // matching query. Integer columns are checked first and category names
+    // once per snapshot category, so descriptions are only read for rows
+    // that pass everything else.
+    template <typename Visit>
+    static bool scanPartitionFile(const std::string& path, const ExpenseQuery& query, Visit visit) {
+        MappedFile file(path);
+        SnapshotColumns columns;
+        if (!file.isOpen() || !parseSnapshot(file.view(), columns)) return false;
+        
+        std::vector<char> categoryOk(columns.categories.size());
+        std::vector<char> categoryText(columns.categories.size());
+        for (size_t i = 0; i < columns.categories.size(); ++i) {
+            categoryOk[i] = query.matchesCategory(columns.categories[i]);
+            categoryText[i] = query.matchesText(columns.categories[i], std::string_view());
+        }
+        
+        for (size_t i = 0; i < columns.rows; ++i) {
+            uint32_t category = columns.categoryIndexes[i];
+            if (!categoryOk[category] || !query.matchesDate(columns.dates[i]) ||
+                !query.matchesAmount(columns.amounts[i])) {
+                continue;
+            }
+            if (!categoryText[category] && !query.matchesText(std::string_view(), columns.description(i))) continue;
+            visit(columns.ids[i], columns.dates[i], columns.categories[category],
+                  columns.amounts[i], columns.description(i));
+        }
+        return true;
+    }
+    
+    // Scan a CSV file without loading it. Fields are split in place and
+    // checked cheapest first: date, amount, then category; the description
+    // is only unquoted for rows that reach the keyword test. Rows are
+    // identified by their Id column, or by line number when there is none.
+    // Lines the loader would reject are skipped.
+    static void queryCSVFile(const std::string& path, const ExpenseQuery& query, QueryResult& result) {
+        MappedFile file(path);
+        if (!file.isOpen()) throw std::runtime_error("Could not open file '" + path + "'");
+        
+        std::string_view text = file.view();
+        std::string_view line;
+        size_t pos = 0;
+        int lineNumber = 0;
+        bool idColumn = false;
+        if (nextCSVLine(text, pos, line)) {
+            lineNumber++;
+            idColumn = hasIdColumn(line);
+        }
+        
+        size_t first = idColumn ? 1 : 0;
+        std::string_view fields[5];
+        while (nextCSVLine(text, pos, line)) {
+            lineNumber++;
+            if (line.empty() || splitCSVFields(line, fields, 5) < 4 + first) continue;
+            try {
+                uint32_t date = parseDate(fields[first]).toPacked();
+                if (!query.matchesDate(date)) continue;
+                int64_t amount = parseAmount(fields[first + 3]);
+                if (amount <= 0 || !query.matchesAmount(amount)) continue;
+                
+                std::string category = unquoteField(fields[first + 1]);
+                if (!query.matchesCategory(category)) continue;
+                std::string description;
+                if (!query.matchesText(category, std::string_view())) {
+                    description = unquoteField(fields[first + 2]);
+                    if (!query.matchesText(std::string_view(), description)) continue;
+                } else if (result.select == "rows") {
+                    description = unquoteField(fields[first + 2]);
+                }
+                
+                int id = idColumn ? parseId(fields[0]) : lineNumber;
+                result.add(id, date, category, amount, description);
+            } catch (const std::exception&) {
+                continue;
+            }
+        }
+    }
+    
+    // Discard uncommitted batch changes by reloading the saved ledger
+    void rollbackBatch(std::ostream& out, size_t operations) {
+        std::unique_lock<std::shared_mutex> lock = lockWhenIdle();
+        loadFromCSV();
+        replayJournal();
+        dirty = false;
+        loadBudget();
+        budgetDirty = false;
+        out << "{\"op\":\"rollback\",\"ok\":true,\"discarded\":" << operations << "}\n";
+    }
+    
+    size_t batchSlot(const std::string& field) {
+        size_t slot = locate(parseId(field));
+        if (slot == ExpenseStore::npos) {
+            throw std::runtime_error("Expense with ID " + field + " not found");
+        }
+        return slot;
+    }
+    
+    // Category named by fields[index], or DailyTotals::ALL when absent. A
+    // name that was never used maps to an id with no expenses.
+    static uint32_t batchCategory(const std::vector<std::string>& fields, size_t index) {
+        if (index >= fields.size()) return DailyTotals::ALL;
+        const CategoryDictionary& dictionary = CategoryDictionary::global();
+        uint32_t id;
+        return dictionary.find(fields[index], id) ? id : static_cast<uint32_t>(dictionary.size());
+    }
+    
+    static int64_t parseBatchAmount(const std::string& field) {
+        int64_t amount = parseAmount(field);
+        if (amount <= 0) throw std::runtime_error("Amount must be positive");
+        return amount;
+    }
+    
+    static int parseBatchInteger(std::string_view field, const char* error) {
+        field = trimField(field);
+        int value = 0;
+        auto result = std::from_chars(field.data(), field.data() + field.size(), value);
+        if (result.ec != std::errc() || result.ptr != field.data() + field.size()) {
+            throw std::runtime_error(error);
+        }
+        return value;
+    }
+    
+    static std::string jsonEscape(const std::string& text) {
+        std::string escaped;
+        escaped.reserve(text.size());
+        appendJSONEscaped(escaped, text);
+        return escaped;
+    }
+    
+    static void appendJSONEscaped(std::string& escaped, std::string_view text) {
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+                escaped += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char buffer[8];
+                std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                escaped += buffer;
+            } else {
+                escaped += c;
+            }
+        }
+    }
+    
+    static std::string jsonString(const std::string& text) {
+        return "\"" + jsonEscape(text) + "\"";
+    }
+    
+    static std::vector<std::string> splitCSVLine(const std::string& line) {
+        std::vector<std::string> fields;
+        std::string field;
+        bool inQuotes = false;
+        
+        for (size_t i = 0; i < line.length(); ++i) {
+            char c = line[i];
+            
+            if (c == '"') {
+                // A doubled quote inside a quoted field is a literal quote
+                if (inQuotes && i + 1 < line.length() && line[i + 1] == '"') {
+                    field += c;
+                    ++i;
+                } else {
+                    inQuotes = !inQuotes;
+                }
+            } else if (c == ',' && !inQuotes) {
+                fields.push_back(field);
+                field.clear();
+            } else {
+                field += c;
+            }
+        }
+        fields.push_back(field);
+        return fields;
+    }
+    
+    static std::string quoteCSVField(const std::string& field) {
+        std::string quoted;
+        appendCSVField(quoted, field);
+        return quoted;
+    }
+    
+    // Append field, quoted only if it holds a separator, quote or newline
+    static void appendCSVField(std::string& text, std::string_view field) {
+        if (field.find_first_of(",\"\r\n") == std::string_view::npos) {
+            text += field;
+            return;
+        }
+        
+        text += '"';
+        for (char c : field) {
+            if (c == '"') text += '"';
+            text += c;
+        }
+        text += '"';
+    }
+    
+    // Advance pos past the next line of text, stripping any trailing '\r'
+    static bool nextCSVLine(std::string_view text, size_t& pos, std::string_view& line) {
+        if (pos >= text.size()) return false;
+        
+        size_t end = text.find('\n', pos);
+        if (end == std::string_view::npos) end = text.size();
+        
+        line = text.substr(pos, end - pos);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        pos = end + 1;
+        return true;
+    }
+    
+    // Split a line into raw field views, quotes included. Returns the total
+    // number of fields even when it exceeds maxFields.
+    static size_t splitCSVFields(std::string_view line, std::string_view* fields, size_t maxFields) {
+        size_t count = 0;
+        size_t start = 0;
+        bool inQuotes = false;
+        
+        for (size_t i = 0; i < line.size(); ++i) {
+            char c = line[i];
+            if (c == '"') {
+                inQuotes = !inQuotes;
+            } else if (c == ',' && !inQuotes) {
+                if (count < maxFields) fields[count] = line.substr(start, i - start);
+                count++;
+                start = i + 1;
+            }
+        }
+        if (count < maxFields) fields[count] = line.substr(start);
+        return count + 1;
+    }
+    
+    // Materialize a raw field, resolving quoting the same way splitCSVLine does
+    static std::string unquoteField(std::string_view raw) {
+        if (raw.find('"') == std::string_view::npos) {
+            return std::string(raw);
+        }
+        
+        std::string field;
+        field.reserve(raw.size());
+        bool inQuotes = false;
+        for (size_t i = 0; i < raw.size(); ++i) {
+            char c = raw[i];
+            if (c == '"') {
+                if (inQuotes && i + 1 < raw.size() && raw[i + 1] == '"') {
+                    field += c;
+                    ++i;
+                } else {
+                    inQuotes = !inQuotes;
+                }
+            } else {
+                field += c;
+            }
+        }
+        return field;
+    }
+    
+    // Strip surrounding whitespace and quotes from a numeric field
+    static std::string_view trimField(std::string_view field) {
+        while (!field.empty() && (field.front() == ' ' || field.front() == '\t' || field.front() == '"')) {
+            field.remove_prefix(1);
+        }
+        while (!field.empty() && (field.back() == ' ' || field.back() == '\t' || field.back() == '"')) {
+            field.remove_suffix(1);
+        }
+        return field;
+    }
+    
+    static int parseDatePart(std::string_view part) {
+        part = trimField(part);
+        int value = 0;
+        auto result = std::from_chars(part.data(), part.data() + part.size(), value);
+        if (result.ec != std::errc()) {
+            throw std::runtime_error("Invalid date format");
+        }
+        return value;
+    }
+    
+    // Amount in cents
+    static int64_t parseAmount(std::string_view field) {
+        int64_t cents = 0;
+        if (!Money::parse(trimField(field), cents)) {
+            throw std::runtime_error("Invalid amount");
+        }
+        return cents;
+    }
+    
+    // Parse one CSV data line. Returns false for rows without a positive
+    // amount; strings are only materialized for rows that are kept.
+    // Files written by saveToCSV lead with an Id column; older files and
+    // hand-made imports start at Date.
+    static bool parseCSVRow(std::string_view line, bool hasIdColumn, std::vector<ParsedExpense>& rows) {
+        std::string_view fields[5];
+        size_t first = hasIdColumn ? 1 : 0;
+        if (splitCSVFields(line, fields, 5) < 4 + first) {
+            throw std::runtime_error("Invalid CSV format");
+        }
+        
+        int id = hasIdColumn ? parseId(fields[0]) : 0;
+        Date date = parseDate(fields[first]);
+        int64_t amount = parseAmount(fields[first + 3]);
+        if (amount <= 0) return false;
+        
+        rows.push_back(ParsedExpense{id, date, amount, fields[first + 1], fields[first + 2]});
+        return true;
+    }
+    
+    static int parseId(std::string_view field) {
+        field = trimField(field);
+        int value = 0;
+        auto result = std::from_chars(field.data(), field.data() + field.size(), value);
+        if (result.ec != std::errc() || result.ptr != field.data() + field.size() || value <= 0) {
+            throw std::runtime_error("Invalid expense ID");
+        }
+        return value;
+    }
+    
+    static bool hasIdColumn(std::string_view header) {
+        return header.substr(0, 3) == "Id," || header.substr(0, 3) == "id," || header.substr(0, 3) == "ID,";
+    }
+    
+    // Add a parsed row to the store. Ids from our own CSV are kept so they
+    // stay stable across restarts; imported rows always get fresh ids.
+    size_t storeParsedRow(ParsedExpense& row, bool keepId) {
+        int id = row.id;
+        if (!keepId || id == 0) {
+            id = Expense::allocateId();
+        } else if (expenses.contains(id)) {
+            int duplicate = id;
+            id = Expense::allocateId();
+            std::cout << "Duplicate expense ID " << duplicate << ", assigned ID " << id << "\n";
+        } else {
+            Expense::reserveId(id);
+        }
+        
+        if (!partitions.empty()) requireYears(row.date.getYear(), row.date.getYear());
+        
+        // Unquoted descriptions go straight from the file into the arena
+        std::string unquoted;
+        std::string_view description = row.description;
+        if (description.find('"') != std::string_view::npos) {
+            unquoted = unquoteField(description);
+            description = unquoted;
+        }
+        return expenses.append(id, row.amount, row.date.toPacked(), internCategory(row.category), description);
+    }
+    
+    // Intern a raw category field, only building a string when it is quoted
+    static uint32_t internCategory(std::string_view raw) {
+        if (raw.find('"') == std::string_view::npos) {
+            return CategoryDictionary::global().intern(raw);
+        }
+        return CategoryDictionary::global().intern(unquoteField(raw));
+    }
+    
+    bool ingestCSVLine(std::string_view line) {
+        std::vector<ParsedExpense> rows;
+        if (!parseCSVRow(line, false, rows)) return false;
+        
+        storeParsedRow(rows.front(), true);
+        return true;
+    }
+    
+    // Parse a block of CSV data lines and append the kept rows. Large inputs
+    // are split into line-aligned byte ranges parsed on separate threads and
+    // merged in file order. Records never span lines (a newline always ends
+    // the record, as with getline), so each range starts just past a '\n'.
+    // lineOffset is the number of lines that precede text in the file.
+    // Imports echo failing lines and never keep the file's ids. The budget
+    // periods the kept rows count towards are added to budgetPeriods.
+    size_t ingestCSVText(std::string_view text, int lineOffset, bool hasIdColumn, bool importing,
+                         std::set<Budget::PeriodKey>* budgetPeriods = nullptr) {
+        struct ParseError {
+            int line;
+            std::string_view text;
+            std::string message;
+        };
+        struct Chunk {
+            std::vector<ParsedExpense> rows;
+            std::vector<ParseError> errors;
+            int lines = 0;
+            size_t rejected = 0;  // Rows skipped for a non-positive amount
+        };
+        
+        size_t workers = std::thread::hardware_concurrency();
+        if (workers < 2 || text.size() < PARALLEL_INGEST_BYTES) workers = 1;
+        
+        std::vector<size_t> bounds(1, 0);
+        for (size_t i = 1; i < workers; ++i) {
+            size_t b = std::max(bounds.back(), text.size() / workers * i);
+            if (b > 0) {
+                size_t newline = text.find('\n', b - 1);
+                b = newline == std::string_view::npos ? text.size() : newline + 1;
+            }
+            bounds.push_back(b);
+        }
+        bounds.push_back(text.size());
+        
+        std::vector<Chunk> chunks(workers);
+        auto parseChunk = [&](size_t c) {
+            Chunk& chunk = chunks[c];
+            std::string_view range = text.substr(bounds[c], bounds[c + 1] - bounds[c]);
+            std::string_view line;
+            size_t pos = 0;
+            
+            chunk.rows.reserve(range.size() / 32);
+            while (nextCSVLine(range, pos, line)) {
+                chunk.lines++;
+                
+                if (line.empty()) continue;
+                
+                try {
+                    if (!parseCSVRow(line, hasIdColumn, chunk.rows)) chunk.rejected++;
+                } catch (const std::exception& e) {
+                    chunk.errors.push_back(ParseError{chunk.lines, line, e.what()});
+                }
+            }
+        };
+        
+        std::vector<std::thread> threads;
+        for (size_t c = 1; c < workers; ++c) {
+            threads.emplace_back(parseChunk, c);
+        }
+        parseChunk(0);
+        for (auto& t : threads) {
+            t.join();
+        }
+        
+        size_t total = 0;
+        for (const auto& chunk : chunks) {
+            total += chunk.rows.size();
+            Metrics::add(Metrics::RowsRejected, chunk.rejected + chunk.errors.size());
+        }
+        Metrics::add(Metrics::RowsParsed, total);
+        expenses.reserve(expenses.size() + total);
+        
+        int lineBase = lineOffset;
+        for (auto& chunk : chunks) {
+            for (const auto& error : chunk.errors) {
+                if (importing) {
+                    std::cout << "Error parsing line " << (lineBase + error.line) << ": " << error.text << "\n";
+                    std::cout << "Error: " << error.message << "\n";
+                } else {
+                    std::cout << "Error parsing line " << (lineBase + error.line) << ": " << error.message << "\n";
+                }
+            }
+            for (auto& row : chunk.rows) {
+                size_t slot = storeParsedRow(row, !importing);
+                if (budgetPeriods) budget.touch(expenses.date(slot), expenses.categoryId(slot), *budgetPeriods);
+            }
+            lineBase += chunk.lines;
+            chunk.rows.clear();
+            chunk.rows.shrink_to_fit();
+        }
+        
+        return total;
+    }
+    
+    static Date parseDate(std::string_view dateStr) {
+        dateStr = trimField(dateStr);
+        
+        // Fast path for the fixed-width DD-MM-YYYY layout we write ourselves
+        if (dateStr.size() == 10 && dateStr[2] == '-' && dateStr[5] == '-') {
+            const char* p = dateStr.data();
+            bool digits = true;
+            for (int i : {0, 1, 3, 4, 6, 7, 8, 9}) {
+                if (p[i] < '0' || p[i] > '9') digits = false;
+            }
+            if (digits) {
+                return checkedDate((p[0] - '0') * 10 + (p[1] - '0'),
+                                   (p[3] - '0') * 10 + (p[4] - '0'),
+                                   (p[6] - '0') * 1000 + (p[7] - '0') * 100 + (p[8] - '0') * 10 + (p[9] - '0'));
+            }
+        }
+        
+        size_t first = dateStr.find('-');
+        size_t second = first == std::string_view::npos ? first : dateStr.find('-', first + 1);
+        if (second == std::string_view::npos || dateStr.find('-', second + 1) != std::string_view::npos) {
+            throw std::runtime_error("Invalid date format");
+        }
+        
+        return checkedDate(parseDatePart(dateStr.substr(0, first)),
+                           parseDatePart(dateStr.substr(first + 1, second - first - 1)),
+                           parseDatePart(dateStr.substr(second + 1)));
+    }
+    
+    // Reject dates that cannot round-trip through Date::toPacked
+    static Date checkedDate(int day, int month, int year) {
+        if (day < 1 || day > 31 || month < 1 || month > 12 || year < 0 || year > 999999) {
+            throw std::runtime_error("Invalid date format");
+        }
+        return Date(day, month, year);
+    }
+    
+    void loadFromCSV() {
+        Metrics::Timer timer(Metrics::Load);
+        expenses.clear();
+        partitions.clear();
+        hotYear = 0;
+        
+        if (loadManifest()) return;
+        
+        MappedFile file(csvFile);
+        if (!file.isOpen()) {
+            std::cout << "CSV file '" << csvFile << "' not found. Starting with empty expense list.\n";
+            return;
+        }
+        
+        std::string_view text = file.view();
+        std::string_view line;
+        size_t pos = 0;
+        int lineNumber = 0;
+        bool idColumn = false;
+        
+        // Skip header line if it exists
+        if (nextCSVLine(text, pos, line)) {
+            lineNumber++;
+            // Check if first line is a header
+            if (line.find("Date,Category,Description,Amount") != std::string_view::npos ||
+                line.find("date,category,description,amount") != std::string_view::npos) {
+                // It's a header, skip it
+                idColumn = hasIdColumn(line);
+                std::cout << "Found CSV header, loading data...\n";
+            } else {
+                // First line is data, parse it
+                try {
+                    ingestCSVLine(line);
+                } catch (const std::exception& e) {
+                    std::cout << "Error parsing first line: " << e.what() << "\n";
+                }
             }
-            default:
-                std::cout << "Invalid choice.\n";
         }
+        
+        // Parse remaining lines
+        ingestCSVText(text.substr(std::min(pos, text.size())), lineNumber, idColumn, false);
+        
+        std::cout << "Loaded " << expenses.size() << " expenses from '" << csvFile << "'\n";
+        
+        // Only reached when the snapshot is missing, stale or unreadable
+        saveSnapshot();
     }
     
-    void viewAllExpenses() const {
-        if (expenses.empty()) {
-            std::cout << "No expenses recorded.\n";
-            return;
+    // Binary snapshot layout, in the byte order of the machine that wrote
+    // it; byteOrder lets other machines reject the file:
+    //   SnapshotHeader
+    //   category dictionary: categoryCount x (uint32 length, bytes)
+    //   padding to 8 bytes
+    //   packed dates: uint32[rowCount]
+    //   category indexes: uint32[rowCount]
+    //   expense ids: int32[rowCount]
+    //   padding to 8 bytes
+    //   amounts: int64 cents[rowCount]
+    //   description offsets: uint64[rowCount + 1] into the string heap
+    //   description string heap: heapBytes
+    // Each partition file is a snapshot of one year's rows.
+    struct SnapshotHeader {
+        char magic[8];
+        uint32_t byteOrder;
+        uint32_t categoryCount;
+        uint64_t rowCount;
+        uint64_t heapBytes;
+        uint64_t csvChecksum;  // Checksum of the CSV this snapshot mirrors
+    };
+    
+    static constexpr char SNAPSHOT_MAGIC[8] = {'E', 'X', 'P', 'S', 'N', 'A', 'P', '3'};
+    static constexpr uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+    
+    static size_t alignTo8(size_t offset) {
+        return (offset + 7) & ~static_cast<size_t>(7);
+    }
+    
+    // A snapshot's columns, checked to fit together. Category names and
+    // descriptions point into the snapshot's bytes.
+    struct SnapshotColumns {
+        std::vector<std::string_view> categories;
+        std::vector<uint32_t> dates;
+        std::vector<uint32_t> categoryIndexes;
+        std::vector<int32_t> ids;
+        std::vector<int64_t> amounts;
+        std::vector<uint64_t> offsets;
+        const char* heap = nullptr;
+        size_t rows = 0;
+        
+        std::string_view description(size_t row) const {
+            return std::string_view(heap + offsets[row], offsets[row + 1] - offsets[row]);
+        }
+    };
+    
+    static bool parseSnapshot(std::string_view data, SnapshotColumns& columns) {
+        SnapshotHeader header;
+        if (data.size() < sizeof(header)) return false;
+        std::memcpy(&header, data.data(), sizeof(header));
+        if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+            header.byteOrder != SNAPSHOT_BYTE_ORDER) {
+            return false;
         }
         
-        std::cout << "\n=== ALL EXPENSES ===\n";
-        for (const auto& expense : expenses) {
-            std::cout << expense.toString() << "\n";
+        size_t pos = sizeof(header);
+        columns.categories.clear();
+        for (uint32_t i = 0; i < header.categoryCount; ++i) {
+            uint32_t length;
+            if (data.size() - pos < sizeof(length)) return false;
+            std::memcpy(&length, data.data() + pos, sizeof(length));
+            pos += sizeof(length);
+            if (data.size() - pos < length) return false;
+            columns.categories.push_back(std::string_view(data.data() + pos, length));
+            pos += length;
+        }
+        
+        size_t rows = static_cast<size_t>(header.rowCount);
+        size_t datesAt = alignTo8(pos);
+        size_t categoriesAt = datesAt + rows * sizeof(uint32_t);
+        size_t idsAt = categoriesAt + rows * sizeof(uint32_t);
+        size_t amountsAt = alignTo8(idsAt + rows * sizeof(int32_t));
+        size_t offsetsAt = amountsAt + rows * sizeof(int64_t);
+        size_t heapAt = offsetsAt + (rows + 1) * sizeof(uint64_t);
+        if (header.rowCount > data.size() || heapAt > data.size() ||
+            data.size() - heapAt != header.heapBytes) {
+            return false;
         }
         
-        double total = getTotalExpenses();
-        std::cout << "\nTotal Expenses: " << std::fixed << std::setprecision(2) << total << "\n";
+        columns.rows = rows;
+        columns.dates.resize(rows);
+        columns.categoryIndexes.resize(rows);
+        columns.ids.resize(rows);
+        columns.amounts.resize(rows);
+        columns.offsets.resize(rows + 1);
+        std::memcpy(columns.dates.data(), data.data() + datesAt, rows * sizeof(uint32_t));
+        std::memcpy(columns.categoryIndexes.data(), data.data() + categoriesAt, rows * sizeof(uint32_t));
+        std::memcpy(columns.ids.data(), data.data() + idsAt, rows * sizeof(int32_t));
+        std::memcpy(columns.amounts.data(), data.data() + amountsAt, rows * sizeof(int64_t));
+        std::memcpy(columns.offsets.data(), data.data() + offsetsAt, (rows + 1) * sizeof(uint64_t));
+        columns.heap = data.data() + heapAt;
+        
+        for (size_t i = 0; i < rows; ++i) {
+            if (columns.categoryIndexes[i] >= columns.categories.size() ||
+                columns.offsets[i] > columns.offsets[i + 1] ||
+                columns.offsets[i + 1] > header.heapBytes || columns.ids[i] <= 0) {
+                return false;
+            }
+        }
+        return true;
     }
     
-    void viewExpensesByCategory() const {
-        if (expenses.empty()) {
-            std::cout << "No expenses recorded.\n";
-            return;
-        }
+    static std::string partitionFile(const std::string& csv, int year, uint64_t generation) {
+        return csv + "." + std::to_string(year) + "-" + std::to_string(generation) + ".snapshot";
+    }
+    
+    // Append the rows of year's partition file. Nothing is kept from a file
+    // that fails to load.
+    bool loadPartitionFile(int year, const std::string& path) {
+        MappedFile file(path);
+        SnapshotColumns columns;
+        if (!file.isOpen() || !parseSnapshot(file.view(), columns)) return false;
         
-        std::map<std::string, double> categoryTotals;
-        for (const auto& expense : expenses) {
-            categoryTotals[expense.getCategory()] += expense.getAmount();
+        // Map the snapshot's category indexes onto dictionary ids
+        std::vector<uint32_t> categories;
+        categories.reserve(columns.categories.size());
+        for (std::string_view name : columns.categories) {
+            categories.push_back(CategoryDictionary::global().intern(name));
         }
         
-        std::cout << "\n=== EXPENSES BY CATEGORY ===\n";
-        for (const auto& pair : categoryTotals) {
-            std::cout << pair.first << ": " << std::fixed << std::setprecision(2) 
-                     << pair.second << "\n";
+        expenses.reserve(expenses.slotCount() + columns.rows, static_cast<size_t>(columns.offsets[columns.rows]));
+        for (size_t i = 0; i < columns.rows; ++i) {
+            if (ExpenseStore::yearOf(columns.dates[i]) != year || expenses.contains(columns.ids[i])) {
+                expenses.eraseYear(year);  // The year was not resident before
+                return false;
+            }
+            Expense::reserveId(columns.ids[i]);
+            expenses.append(columns.ids[i], columns.amounts[i], columns.dates[i],
+                            categories[columns.categoryIndexes[i]], columns.description(i));
         }
+        return true;
     }
     
-    void viewMonthlyReport(int month, int year) const {
-        std::vector<Expense> monthlyExpenses;
-        double total = 0.0;
-
-        std::cout << "Total expenses in database: " << expenses.size() << "\n";
+    // Manifest layout, one line each:
+    //   #manifest,<csv checksum>,<generation>
+    //   <year>,<generation>,<rows>,<min id>,<max id>[,<category>,<cents>,<rows>]...
+    // Every year with expenses has a line naming its partition file, then
+    // its totals per category so that summaries need not page it in. The
+    // manifest is only trusted while the CSV still has the checksum it was
+    // written for and every partition file it names has a header that
+    // matches it, in this machine's byte order; otherwise the CSV wins.
+    bool loadManifest() {
+        std::ifstream file(manifestFile);
+        if (!file.is_open()) return false;
         
-        for (const auto& expense : expenses) {
-            Date expenseDate = expense.getDate();
-            
+        std::string line;
+        std::map<int, Partition> loaded;
+        uint64_t generation = 0;
+        uint64_t csvSum = 0;
+        try {
+            if (!getline(file, line)) return false;
+            std::vector<std::string> header = splitCSVLine(line);
+            if (header.size() != 3 || header[0] != "#manifest") return false;
+            csvSum = std::stoull(header[1]);
+            if (csvSum != csvChecksum()) return false;
+            generation = std::stoull(header[2]);
             
-            if (expenseDate.getMonth() == month && expenseDate.getYear() == year) {
-                monthlyExpenses.push_back(expense);
-                total += expense.getAmount();
-                
+            while (getline(file, line)) {
+                if (line.empty()) continue;
+                std::vector<std::string> fields = splitCSVLine(line);
+                if (fields.size() < 5 || (fields.size() - 5) % 3 != 0) return false;
+                Partition& partition = loaded[std::stoi(fields[0])];
+                partition.generation = std::stoull(fields[1]);
+                partition.rows = std::stoull(fields[2]);
+                partition.minId = std::stoi(fields[3]);
+                partition.maxId = std::stoi(fields[4]);
+                for (size_t i = 5; i < fields.size(); i += 3) {
+                    partition.totals.add(CategoryDictionary::global().intern(fields[i]), std::stoll(fields[i + 1]),
+                                         std::stoull(fields[i + 2]));
+                }
+                if (partition.totals.rows != partition.rows) return false;
             }
+        } catch (const std::exception&) {
+            return false;
         }
         
-        if (monthlyExpenses.empty()) {
-            std::cout << "No expenses found for " << month << "/" << year << "\n";
-            std::cout << "Available months/years in data:\n";
-            
-            // Show available dates for debugging
-            std::set<std::pair<int, int>> availableDates;
-            for (const auto& expense : expenses) {
-                availableDates.insert({expense.getDate().getMonth(), expense.getDate().getYear()});
-            }
-            
-            for (const auto& date : availableDates) {
-                std::cout << "  " << date.first << "/" << date.second << "\n";
+        for (const auto& entry : loaded) {
+            if (!partitionHeaderMatches(partitionFile(csvFile, entry.first, entry.second.generation),
+                                        entry.second.rows, csvSum)) {
+                return false;
             }
-            return;
         }
         
-        std::cout << "\n=== MONTHLY REPORT (" << month << "/" << year << ") ===\n";
-        for (const auto& expense : monthlyExpenses) {
-            std::cout << expense.toString() << "\n";
+        partitions.swap(loaded);
+        partitionGeneration = std::max(partitionGeneration, generation);
+        for (const auto& entry : partitions) {
+            Expense::reserveId(entry.second.maxId);
+        }
+        if (partitions.empty()) {
+            std::cout << "Loaded 0 expenses from snapshot '" << manifestFile << "'\n";
+            return true;
         }
         
-        std::cout << "\nTotal for " << month << "/" << year << ": " 
-                 << std::fixed << std::setprecision(2) << total << "\n";
-        
-        // Category breakdown for the month
-        std::map<std::string, double> categoryTotals;
-        for (const auto& expense : monthlyExpenses) {
-            categoryTotals[expense.getCategory()] += expense.getAmount();
+        // Only the newest year is loaded now; requireYears pages in the rest
+        hotYear = partitions.rbegin()->first;
+        Partition& hot = partitions.rbegin()->second;
+        if (!loadPartitionFile(hotYear, partitionFile(csvFile, hotYear, hot.generation))) {
+            partitions.clear();
+            return false;
         }
+        hot.resident = true;
+        hot.lastUse = ++partitionClock;
+        hot.savedVersion = expenses.yearVersion(hotYear);
         
-        std::cout << "\nCategory Breakdown:\n";
-        for (const auto& pair : categoryTotals) {
-            std::cout << "  " << pair.first << ": " << std::fixed << std::setprecision(2) 
-                     << pair.second << "\n";
+        std::cout << "Loaded " << expenses.size() << " expenses from snapshot '" << manifestFile << "'";
+        if (ledgerSize() > expenses.size()) {
+            std::cout << " (" << hotYear << "; " << ledgerSize() - expenses.size()
+                      << " earlier expenses load when needed)";
         }
+        std::cout << "\n";
+        return true;
     }
     
+    // Whether path starts with a snapshot header written in this machine's
+    // byte order, for rows rows of the CSV with checksum csvSum
+    static bool partitionHeaderMatches(const std::string& path, uint64_t rows, uint64_t csvSum) {
+        SnapshotHeader header;
+        std::ifstream file(path, std::ios::binary);
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+        return std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+               header.byteOrder == SNAPSHOT_BYTE_ORDER && header.rowCount == rows &&
+               header.csvChecksum == csvSum;
+    }
     
-    void searchExpenses(const std::string& keyword) const {
-        std::vector<Expense> results;
+    // Rows in the whole ledger, resident or not
+    size_t ledgerSize() const {
+        size_t rows = expenses.size();
+        for (const auto& entry : partitions) {
+            if (!entry.second.resident) rows += entry.second.rows;
+        }
+        return rows;
+    }
+    
+    // Page in the partitions for years first to last. Caller holds
+    // storeMutex. Anything that adds a row must first page in its year, so
+    // a year is either wholly resident or wholly in its partition file.
+    void requireYears(int first, int last) {
+        partitionClock++;
+        auto end = partitions.upper_bound(last);
+        for (auto it = partitions.lower_bound(first); it != end; ++it) {
+            it->second.lastUse = partitionClock;
+            if (!it->second.resident) pageIn(it->first, it->second);
+        }
+    }
+    
+    // The current snapshot, after making the years read needs resident.
+    // A new snapshot is taken only when the ledger changed since the last
+    // one, so reads between writes share one copy. The copy shares the
+    // ledger's storage (see WriteEpoch) and costs pointers, not rows; it
+    // holds storeMutex shared, so writers wait for it but never for the
+    // reads that follow. Searches need the keyword index and statistics
+    // the sketches; both are brought up to date on the live store, where
+    // writes keep them current, and copied from there.
+    std::shared_ptr<const LedgerSnapshot> pinSnapshot(const BatchRead& read) {
+        std::lock_guard<std::mutex> pinning(snapshotMutex);
+        while (true) {
+            {
+                std::shared_lock<std::shared_mutex> shared(storeMutex);
+                if (yearsResident(read.firstYear, read.lastYear) &&
+                    (!read.keywords || expenses.keywordIndexReady()) &&
+                    (!read.sketches || expenses.sketchesCurrent())) {
+                    if (!snapshot || snapshotVersion != expenses.version() ||
+                        (read.keywords && !snapshot->store.keywordIndexReady()) ||
+                        (read.sketches && !snapshot->store.sketchesCurrent())) {
+                        snapshot = std::make_shared<const LedgerSnapshot>(expenses, partitions);
+                        snapshotVersion = expenses.version();
+                    }
+                    return snapshot;
+                }
+            }
+            
+            // The server never evicts, so one pass is enough
+            std::lock_guard<std::shared_mutex> lock(storeMutex);
+            if (read.firstYear <= read.lastYear) requireYears(read.firstYear, read.lastYear);
+            if (read.keywords) expenses.buildKeywordIndex();
+            if (read.sketches) expenses.refreshSketches();
+        }
+    }
+    
+    // Whether years first to last are all in memory. Caller holds
+    // storeMutex, shared or not.
+    bool yearsResident(int first, int last) const {
+        if (first > last) return true;
+        auto end = partitions.upper_bound(last);
+        for (auto it = partitions.lower_bound(first); it != end; ++it) {
+            if (!it->second.resident) return false;
+        }
+        return true;
+    }
+    
+    void requireAllYears() {
+        requireYears(std::numeric_limits<int>::min(), std::numeric_limits<int>::max());
+    }
+    
+    void pageIn(int year, Partition& partition) {
+        Metrics::Timer timer(Metrics::Load);
+        std::string path = partitionFile(csvFile, year, partition.generation);
+        if (loadPartitionFile(year, path)) {
+            partition.resident = true;
+            partition.savedVersion = expenses.yearVersion(year);
+        } else {
+            std::cout << "Error: Could not load snapshot partition '" << path << "'\n";
+        }
+    }
+    
+    // Make years first to last resident for reading, then evict the least
+    // recently used cold partitions past MAX_COLD_PARTITIONS. Returns the
+    // number of rows in the whole ledger.
+    size_t loadYears(int first, int last) {
+        std::lock_guard<std::shared_mutex> lock(storeMutex);
+        requireYears(first, last);
+        evictColdPartitions();
+        return ledgerSize();
+    }
+    
+    void loadAllYears() {
+        loadYears(std::numeric_limits<int>::min(), std::numeric_limits<int>::max());
+    }
+    
+    // Totals by category over the whole ledger. Cold years answer from the
+    // totals their manifest lines carry, so nothing is paged in.
+    CategoryTotals ledgerCategoryTotals() {
+        std::shared_lock<std::shared_mutex> lock(storeMutex);
+        CategoryTotals totals = expenses.ledgerTotals();
+        for (const auto& entry : partitions) {
+            if (!entry.second.resident) totals.merge(entry.second.totals);
+        }
+        return totals;
+    }
+    
+    // Expenses matching query, in id order. Cold years within the query's
+    // dates are scanned in their partition files rather than paged in, so
+    // the resident years stay as they are.
+    std::vector<Expense> ledgerMatches(const ExpenseQuery& query) {
+        std::lock_guard<std::shared_mutex> lock(storeMutex);
+        std::vector<size_t> slots;
+        expenses.select(query, slots);
+        std::vector<Expense> matches;
+        matches.reserve(slots.size());
+        for (size_t slot : slots) matches.push_back(expenses.at(slot));
+        
+        int firstYear = ExpenseStore::yearOf(query.firstDate);
+        int lastYear = ExpenseStore::yearOf(query.lastDate);
+        for (const auto& entry : partitions) {
+            if (entry.second.resident || entry.first < firstYear || entry.first > lastYear) continue;
+            std::string file = partitionFile(csvFile, entry.first, entry.second.generation);
+            bool read = scanPartitionFile(file, query, [&matches](int id, uint32_t date, std::string_view category,
+                                                                  int64_t amount, std::string_view description) {
+                matches.emplace_back(id, amount, std::string(category), std::string(description),
+                                     Date::fromPacked(date));
+            });
+            if (!read) std::cout << "Error: Could not read snapshot partition '" << file << "'\n";
+        }
         
-        for (const auto& expense : expenses) {
-            if (expense.getCategory().find(keyword) != std::string::npos ||
-                expense.getDescription().find(keyword) != std::string::npos) {
-                results.push_back(expense);
+        std::sort(matches.begin(), matches.end(),
+                  [](const Expense& a, const Expense& b) { return a.getId() < b.getId(); });
+        return matches;
+    }
+    
+    // Saves copy cold years straight from their partition files, so a year
+    // may only be dropped while its rows still match its file. A save in
+    // flight is no obstacle: it writes the rows it captured, which match
+    // too, and installPartitions keeps a dropped year cold. Caller holds
+    // storeMutex.
+    void evictColdPartitions() {
+        std::vector<std::pair<uint64_t, int>> candidates;  // (lastUse, year)
+        for (const auto& entry : partitions) {
+            if (entry.second.resident && entry.first != hotYear) {
+                candidates.push_back({entry.second.lastUse, entry.first});
             }
         }
+        if (candidates.size() <= MAX_COLD_PARTITIONS) return;
         
-        if (results.empty()) {
-            std::cout << "No expenses found containing '" << keyword << "'\n";
-            return;
+        std::sort(candidates.begin(), candidates.end());
+        candidates.resize(candidates.size() - MAX_COLD_PARTITIONS);
+        for (const auto& candidate : candidates) {
+            if (candidate.first == partitionClock) continue;  // Wanted by this request
+            Partition& partition = partitions[candidate.second];
+            if (expenses.yearVersion(candidate.second) != partition.savedVersion) continue;  // Unsaved
+            partition.totals = expenses.yearTotals(candidate.second);
+            expenses.eraseYear(candidate.second);
+            partition.resident = false;
         }
+    }
+    
+    // Slot for id, paging in any partition whose id range holds it, or npos.
+    // Caller holds storeMutex.
+    size_t locate(int id) {
+        size_t slot = expenses.findSlot(id);
+        if (slot != ExpenseStore::npos) return slot;
         
-        std::cout << "\n=== SEARCH RESULTS for '" << keyword << "' ===\n";
-        for (const auto& expense : results) {
-            std::cout << expense.toString() << "\n";
+        bool pagedIn = false;
+        for (auto& entry : partitions) {
+            Partition& partition = entry.second;
+            if (!partition.resident && partition.minId <= id && id <= partition.maxId) {
+                partition.lastUse = ++partitionClock;
+                pageIn(entry.first, partition);
+                pagedIn = true;
+            }
         }
+        return pagedIn ? expenses.findSlot(id) : ExpenseStore::npos;
     }
     
-    void getTopCategories(int limit = 5) const {
-        std::map<std::string, double> categoryTotals;
-        for (const auto& expense : expenses) {
-            categoryTotals[expense.getCategory()] += expense.getAmount();
+    // Snapshot bytes for the given live slots. The csvChecksum field is
+    // filled in by writePartitions once the CSV is known.
+    std::string snapshotBytes(const std::vector<size_t>& slots) const {
+        // The dictionary is written whole, so category indexes are dictionary ids
+        const CategoryDictionary& dictionary = CategoryDictionary::global();
+        const SharedColumn<uint32_t>& dates = expenses.dateColumn();
+        const SharedColumn<uint32_t>& categoryIndexes = expenses.categoryColumn();
+        const SharedColumn<int>& ids = expenses.idColumn();
+        const SharedColumn<int64_t>& amounts = expenses.amountColumn();
+        
+        uint64_t heapBytes = 0;
+        for (size_t slot : slots) heapBytes += expenses.description(slot).size();
+        
+        SnapshotHeader header;
+        std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.byteOrder = SNAPSHOT_BYTE_ORDER;
+        header.categoryCount = static_cast<uint32_t>(dictionary.size());
+        header.rowCount = slots.size();
+        header.heapBytes = heapBytes;
+        header.csvChecksum = 0;
+        
+        std::string bytes;
+        bytes.reserve(sizeof(header) + slots.size() * 36 + heapBytes + 64);
+        auto put = [&bytes](const auto& value) {
+            bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        };
+        auto pad = [&bytes]() { bytes.append(alignTo8(bytes.size()) - bytes.size(), '\0'); };
+        
+        put(header);
+        for (uint32_t id = 0; id < dictionary.size(); ++id) {
+            const std::string& category = dictionary.name(id);
+            put(static_cast<uint32_t>(category.size()));
+            bytes += category;
         }
+        pad();
         
-        std::vector<std::pair<std::string, double>> sortedCategories(
-            categoryTotals.begin(), categoryTotals.end());
+        static_assert(sizeof(int) == sizeof(int32_t), "snapshot stores ids as int32");
+        for (size_t slot : slots) put(dates[slot]);
+        for (size_t slot : slots) put(categoryIndexes[slot]);
+        for (size_t slot : slots) put(static_cast<int32_t>(ids[slot]));
+        pad();
+        for (size_t slot : slots) put(amounts[slot]);
         
-        std::sort(sortedCategories.begin(), sortedCategories.end(),
-            [](const auto& a, const auto& b) { return a.second > b.second; });
+        uint64_t offset = 0;
+        put(offset);
+        for (size_t slot : slots) {
+            offset += expenses.description(slot).size();
+            put(offset);
+        }
+        for (size_t slot : slots) bytes += expenses.description(slot);
+        return bytes;
+    }
+    
+    // Partition files and a manifest for the CSV as it is on disk
+    bool saveSnapshot() {
+        PendingSave save;
+        capturePartitions(save, residentYears());
+        save.csvChecksum = csvChecksum();
+        save.partitionsWritten = writePartitions(save);
+        installPartitions(save);
+        return save.partitionsWritten;
+    }
+    
+    static void appendCSVRow(std::string& text, int id, uint32_t date, std::string_view category,
+                             std::string_view description, int64_t amount) {
+        text += std::to_string(id);
+        text += ',';
+        appendDate(text, date);
+        text += ',';
+        appendCSVField(text, category);
+        text += ',';
+        appendCSVField(text, description);
+        text += ',';
+        text += Money::format(amount);
+        text += '\n';
+    }
+    
+    // The given rows in CSV form (DD-MM-YYYY dates)
+    std::string csvRows(const std::vector<size_t>& slots) const {
+        std::string text;
+        text.reserve(slots.size() * 48);
+        for (size_t slot : slots) {
+            appendCSVRow(text, expenses.id(slot), expenses.date(slot), expenses.category(slot),
+                         expenses.description(slot), expenses.amount(slot));
+        }
+        return text;
+    }
+    
+    // Append a cold partition's rows in CSV form, in id order. Runs without
+    // storeMutex; partition files never change once written.
+    bool appendPartitionCSV(const std::string& path, std::string& text) const {
+        MappedFile file(path);
+        SnapshotColumns columns;
+        if (!file.isOpen() || !parseSnapshot(file.view(), columns)) return false;
         
-        std::cout << "\n=== TOP " << limit << " SPENDING CATEGORIES ===\n";
-        int count = 0;
-        for (const auto& pair : sortedCategories) {
-            if (count >= limit) break;
-            std::cout << ++count << ". " << pair.first << ": " 
-                     << std::fixed << std::setprecision(2) << pair.second << "\n";
+        // Saves write files in id order, but check rather than trust that
+        std::vector<size_t> order(columns.rows);
+        for (size_t i = 0; i < columns.rows; ++i) order[i] = i;
+        if (!std::is_sorted(columns.ids.begin(), columns.ids.end())) {
+            std::sort(order.begin(), order.end(), [&columns](size_t a, size_t b) { return columns.ids[a] < columns.ids[b]; });
+        }
+        for (size_t i : order) {
+            appendCSVRow(text, columns.ids[i], columns.dates[i], columns.categories[columns.categoryIndexes[i]],
+                         columns.description(i), columns.amounts[i]);
         }
+        return true;
     }
     
-    void importFromCSV(const std::string& filename) {
-        // If importing from the main CSV file, just reload
-        if (filename == csvFile) {
-            expenses.clear();
-            loadFromCSV();
-            std::cout << "Reloaded " << expenses.size() << " expenses from " << filename << "\n";
-            return;
+    // Destination for exported rows. Rows are formatted into one reusable
+    // buffer that is written out whenever it passes EXPORT_BUFFER_BYTES, so
+    // memory stays flat however many rows go through. Output goes to a
+    // temporary file that finish renames into place; an unfinished export
+    // leaves nothing behind.
+    class ExportWriter {
+    private:
+        static inline std::atomic<uint64_t> nextTemp{0};
+        std::string path;
+        std::string tempPath;
+        std::ofstream file;
+        uint64_t written = 0;
+        
+    protected:
+        std::string buffer;
+        
+        void flushIfFull() {
+            if (buffer.size() >= EXPORT_BUFFER_BYTES) flush();
         }
         
-        // Otherwise, merge data from another CSV file
-        std::ifstream file(filename);
-        if (!file.is_open()) {
-            std::cout << "Error: Could not open file '" << filename << "'\n";
-            return;
+        void flush() {
+            file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            written += buffer.size();
+            buffer.clear();
         }
         
-        std::string line;
-        int importedCount = 0;
-        int lineNumber = 0;
+        // Anything that follows the last row
+        virtual void writeEnd() {}
         
-        // Skip header line
-        if (getline(file, line)) {
-            lineNumber++;
-            std::cout << "Skipping header: " << line << "\n";
+    public:
+        // Server clients may export to the same path at once, so each
+        // writer gets its own temporary file
+        explicit ExportWriter(const std::string& target)
+            : path(target), tempPath(target + ".tmp" + std::to_string(nextTemp++)),
+              file(tempPath, std::ios::binary | std::ios::trunc) {
+            buffer.reserve(EXPORT_BUFFER_BYTES + 64 * 1024);
         }
         
-        while (getline(file, line)) {
-            lineNumber++;
-            
-            if (line.empty()) continue;
-            
-            try {
-                Expense expense = parseCSVLine(line);
-                if (expense.getAmount() > 0) {
-                    expenses.push_back(expense);
-                    importedCount++;
-                }
-            } catch (const std::exception& e) {
-                std::cout << "Error parsing line " << lineNumber << ": " << line << "\n";
-                std::cout << "Error: " << e.what() << "\n";
+        virtual ~ExportWriter() {
+            if (file.is_open()) {
+                file.close();
+                std::remove(tempPath.c_str());
             }
         }
         
-        file.close();
-        std::cout << "Successfully imported " << importedCount << " additional expenses from '" << filename << "'\n";
+        bool isOpen() const { return file.is_open(); }
+        uint64_t bytes() const { return written; }
         
-        // Save the merged data to main CSV
-        if (importedCount > 0) {
-            saveToCSV();
-            std::cout << "Updated main CSV file with " << expenses.size() << " total expenses\n";
+        virtual void row(int id, uint32_t date, std::string_view category, std::string_view description,
+                         int64_t amount) = 0;
+        
+        // Write out the rest and move the file into place
+        bool finish() {
+            writeEnd();
+            flush();
+            file.close();
+            Metrics::add(Metrics::BytesWritten, written);
+            if (!file || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+                std::remove(tempPath.c_str());
+                return false;
+            }
+            return true;
         }
-    }
+    };
     
+    static const size_t EXPORT_BUFFER_BYTES = 4 * 1024 * 1024;
     
-
-private:
-    double getTotalExpenses() const {
-        double total = 0.0;
-        for (const auto& expense : expenses) {
-            total += expense.getAmount();
+    // The same layout saveToCSV writes, so exports load back as ledgers
+    class CSVExportWriter : public ExportWriter {
+    public:
+        explicit CSVExportWriter(const std::string& target) : ExportWriter(target) {
+            buffer += "Id,Date,Category,Description,Amount\n";
         }
-        return total;
-    }
+        
+        void row(int id, uint32_t date, std::string_view category, std::string_view description,
+                 int64_t amount) override {
+            appendCSVRow(buffer, id, date, category, description, amount);
+            flushIfFull();
+        }
+    };
     
+    // One JSON object per line, with the fields the batch rows carry
+    class JSONLinesExportWriter : public ExportWriter {
+    public:
+        using ExportWriter::ExportWriter;
+        
+        void row(int id, uint32_t date, std::string_view category, std::string_view description,
+                 int64_t amount) override {
+            buffer += "{\"id\":";
+            buffer += std::to_string(id);
+            buffer += ",\"date\":\"";
+            appendDate(buffer, date);
+            buffer += "\",\"category\":\"";
+            appendJSONEscaped(buffer, category);
+            buffer += "\",\"description\":\"";
+            appendJSONEscaped(buffer, description);
+            buffer += "\",\"amount\":";
+            buffer += Money::format(amount);
+            buffer += "}\n";
+            flushIfFull();
+        }
+    };
     
-    void editExpenseHelper(Expense& expense) {
-        std::cout << "\nCurrent expense: " << expense.toString() << "\n\n";
+    // Self-describing columnar file, in the host's byte order, which the
+    // byte-order word lets readers check:
+    //   "EXPCOL1\n", u32 byte order (0x01020304), u32 column count
+    //   per column: u8 type, u8 name length, name
+    //   row groups of up to GROUP_ROWS rows: u32 rows, then per column
+    //     u8 encoding, u64 byte length, encoded values
+    //   u32 0 after the last group, then u64 total rows
+    // Types are 1 id, 2 date (Date::toPacked), 3 text and 4 cents. Integers
+    // are zigzag LEB128 varints: DELTA stores each value's difference from
+    // the previous row in the group, VARINT the value itself. Text is
+    // DICTIONARY (varint count, length-prefixed strings, then one varint
+    // index per row) when its values repeat enough, PLAIN (varint length
+    // and bytes per row) otherwise.
+    class ColumnarExportWriter : public ExportWriter {
+    private:
+        enum Type : uint8_t { IdType = 1, DateType = 2, TextType = 3, CentsType = 4 };
+        enum Encoding : uint8_t { DELTA = 1, VARINT = 2, DICTIONARY = 3, PLAIN = 4 };
+        static const size_t GROUP_ROWS = 64 * 1024;
         
-        double amount;
-        std::string category, description;
+        // The pending row group. Text is copied, since rows from a
+        // partition file do not outlive its mapping.
+        std::vector<int64_t> ids;
+        std::vector<int64_t> dates;
+        std::vector<int64_t> amounts;
+        std::string text;
+        std::vector<size_t> categoryEnds;  // Offsets into text
+        std::vector<size_t> descriptionEnds;
+        uint64_t rows = 0;
         
-        std::cout << "Enter new amount (current: " << std::fixed << std::setprecision(2) 
-                 << expense.getAmount() << "): ";
-        std::cin >> amount;
+        template <typename T>
+        void put(T value) {
+            buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
         
-        std::cout << "Enter new category (current: " << expense.getCategory() << "): ";
-        std::cin.ignore();
-        getline(std::cin, category);
+        static void putVarint(std::string& out, uint64_t value) {
+            while (value >= 0x80) {
+                out += static_cast<char>((value & 0x7f) | 0x80);
+                value >>= 7;
+            }
+            out += static_cast<char>(value);
+        }
         
-        std::cout << "Enter new description (current: " << expense.getDescription() << "): ";
-        getline(std::cin, description);
+        static uint64_t zigzag(int64_t value) {
+            return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+        }
         
-        expense.setAmount(amount);
-        expense.setCategory(category);
-        expense.setDescription(description);
+        void putChunk(Encoding encoding, const std::string& bytes) {
+            put(static_cast<uint8_t>(encoding));
+            put(static_cast<uint64_t>(bytes.size()));
+            buffer += bytes;
+        }
         
-        std::cout << "Expense updated successfully!\n";
+        void putIntegers(const std::vector<int64_t>& values, bool delta, std::string& scratch) {
+            scratch.clear();
+            int64_t previous = 0;
+            for (int64_t value : values) {
+                putVarint(scratch, zigzag(delta ? value - previous : value));
+                previous = value;
+            }
+            putChunk(delta ? DELTA : VARINT, scratch);
+        }
         
-        // Immediately save to CSV after editing
-        saveToCSV();
-    }
-    
-    void findAndEditByKeyword() {
-        std::string keyword;
-        std::cout << "Enter search keyword (category or description): ";
-        std::cin.ignore();
-        getline(std::cin, keyword);
+        // Row i's value is text[starts[i], ends[i])
+        void putText(const std::vector<size_t>& starts, const std::vector<size_t>& ends, std::string& scratch) {
+            std::unordered_map<std::string_view, uint32_t> dictionary;
+            std::vector<std::string_view> values;
+            std::vector<uint32_t> indexes;
+            indexes.reserve(ends.size());
+            for (size_t i = 0; i < ends.size(); ++i) {
+                std::string_view value(text.data() + starts[i], ends[i] - starts[i]);
+                auto inserted = dictionary.emplace(value, static_cast<uint32_t>(values.size()));
+                if (inserted.second) values.push_back(value);
+                indexes.push_back(inserted.first->second);
+            }
+            
+            scratch.clear();
+            if (values.size() * 2 <= ends.size()) {
+                putVarint(scratch, values.size());
+                for (std::string_view value : values) {
+                    putVarint(scratch, value.size());
+                    scratch += value;
+                }
+                for (uint32_t index : indexes) putVarint(scratch, index);
+                putChunk(DICTIONARY, scratch);
+            } else {
+                for (size_t i = 0; i < ends.size(); ++i) {
+                    putVarint(scratch, ends[i] - starts[i]);
+                    scratch.append(text, starts[i], ends[i] - starts[i]);
+                }
+                putChunk(PLAIN, scratch);
+            }
+        }
         
-        std::vector<const Expense*> matches;
-        for (const auto& expense : expenses) {
-            if (expense.getCategory().find(keyword) != std::string::npos ||
-                expense.getDescription().find(keyword) != std::string::npos) {
-                matches.push_back(&expense);
+        void writeGroup() {
+            if (ids.empty()) return;
+            put(static_cast<uint32_t>(ids.size()));
+            
+            std::string scratch;
+            putIntegers(ids, true, scratch);
+            putIntegers(dates, true, scratch);
+            
+            std::vector<size_t> categoryStarts(ids.size());
+            std::vector<size_t> descriptionStarts(ids.size());
+            for (size_t i = 0; i < ids.size(); ++i) {
+                categoryStarts[i] = i == 0 ? 0 : descriptionEnds[i - 1];
+                descriptionStarts[i] = categoryEnds[i];
             }
+            putText(categoryStarts, categoryEnds, scratch);
+            putText(descriptionStarts, descriptionEnds, scratch);
+            putIntegers(amounts, false, scratch);
+            
+            ids.clear();
+            dates.clear();
+            amounts.clear();
+            text.clear();
+            categoryEnds.clear();
+            descriptionEnds.clear();
+            flushIfFull();
         }
         
-        if (matches.empty()) {
-            std::cout << "No expenses found containing '" << keyword << "'\n";
-            return;
+        void writeEnd() override {
+            writeGroup();
+            put(static_cast<uint32_t>(0));
+            put(rows);
         }
         
-        selectAndEditFromList(matches);
+    public:
+        explicit ColumnarExportWriter(const std::string& target) : ExportWriter(target) {
+            buffer.append("EXPCOL1\n", 8);
+            put(static_cast<uint32_t>(0x01020304));
+            static const std::pair<Type, const char*> columns[] = {
+                {IdType, "id"}, {DateType, "date"}, {TextType, "category"},
+                {TextType, "description"}, {CentsType, "amount"}};
+            put(static_cast<uint32_t>(sizeof(columns) / sizeof(columns[0])));
+            for (const auto& column : columns) {
+                put(static_cast<uint8_t>(column.first));
+                put(static_cast<uint8_t>(std::strlen(column.second)));
+                buffer += column.second;
+            }
+        }
+        
+        void row(int id, uint32_t date, std::string_view category, std::string_view description,
+                 int64_t amount) override {
+            ids.push_back(id);
+            dates.push_back(date);
+            amounts.push_back(amount);
+            text += category;
+            categoryEnds.push_back(text.size());
+            text += description;
+            descriptionEnds.push_back(text.size());
+            rows++;
+            if (ids.size() == GROUP_ROWS) writeGroup();
+        }
+    };
+    
+    // A writer for format (csv, jsonl or columnar), or nullptr if there is
+    // no such format
+    static std::unique_ptr<ExportWriter> createExportWriter(const std::string& format, const std::string& path) {
+        if (format == "csv") return std::make_unique<CSVExportWriter>(path);
+        if (format == "jsonl") return std::make_unique<JSONLinesExportWriter>(path);
+        if (format == "columnar") return std::make_unique<ColumnarExportWriter>(path);
+        return nullptr;
     }
     
-    void findAndEditRecent() {
-        std::vector<const Expense*> sortedExpenses;
-        for (const auto& expense : expenses) {
-            sortedExpenses.push_back(&expense);
-        }
+    // Stream the rows matching query into a new file at path: resident rows
+    // from store, in storage order, then cold years straight from their
+    // partition files. Returns the number of rows; throws if the file
+    // cannot be written.
+    size_t exportRows(const ExpenseStore& store, const std::map<int, Partition>& years, const ExpenseQuery& query,
+                      const std::string& format, const std::string& path, uint64_t& bytes) const {
+        Metrics::Timer timer(Metrics::Export);
+        std::unique_ptr<ExportWriter> writer = createExportWriter(format, path);
+        if (!writer) throw std::runtime_error("Format must be csv, jsonl or columnar");
+        if (!writer->isOpen()) throw std::runtime_error("Could not open file '" + path + "'");
         
-        std::sort(sortedExpenses.begin(), sortedExpenses.end(),
-            [](const Expense* a, const Expense* b) { return a->getId() > b->getId(); });
+        size_t rows = 0;
+        store.scan(query, [&](size_t slot) {
+            writer->row(store.id(slot), store.date(slot), store.category(slot), store.description(slot),
+                        store.amount(slot));
+            rows++;
+        });
         
-        int limit = std::min(10, (int)sortedExpenses.size());
-        std::vector<const Expense*> recentExpenses(sortedExpenses.begin(), 
-                                                   sortedExpenses.begin() + limit);
+        int firstYear = ExpenseStore::yearOf(query.firstDate);
+        int lastYear = ExpenseStore::yearOf(query.lastDate);
+        for (const auto& entry : years) {
+            if (entry.second.resident || entry.first < firstYear || entry.first > lastYear) continue;
+            std::string file = partitionFile(csvFile, entry.first, entry.second.generation);
+            bool read = scanPartitionFile(file, query, [&](int id, uint32_t date, std::string_view category,
+                                                           int64_t amount, std::string_view description) {
+                writer->row(id, date, category, description, amount);
+                rows++;
+            });
+            if (!read) throw std::runtime_error("Could not read snapshot partition '" + file + "'");
+        }
         
-        std::cout << "\n=== RECENT EXPENSES ===\n";
-        selectAndEditFromList(recentExpenses);
+        if (!writer->finish()) throw std::runtime_error("Could not write file '" + path + "'");
+        bytes = writer->bytes();
+        return rows;
     }
     
-    void findAndEditByCategory() {
-        std::set<std::string> categories;
-        for (const auto& expense : expenses) {
-            categories.insert(expense.getCategory());
-        }
+    static bool writeFile(const std::string& path, const std::string& bytes) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return false;
+        file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        file.close();
+        if (file) Metrics::add(Metrics::BytesWritten, bytes.size());
+        return static_cast<bool>(file);
+    }
+    
+    // Bytes [from, to) of a file, or false if they cannot all be read
+    static bool readFileRange(const std::string& path, uint64_t from, uint64_t to, std::string& bytes) {
+        bytes.clear();
+        if (to <= from) return true;
         
-        if (categories.empty()) {
-            std::cout << "No categories found.\n";
-            return;
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) return false;
+        file.seekg(static_cast<std::streamoff>(from));
+        bytes.resize(static_cast<size_t>(to - from));
+        file.read(&bytes[0], static_cast<std::streamsize>(bytes.size()));
+        Metrics::add(Metrics::BytesRead, static_cast<uint64_t>(file.gcount()));
+        return file.gcount() == static_cast<std::streamsize>(bytes.size());
+    }
+    
+    // 64-bit FNV-1a style hash taken over little-endian 8-byte words, so
+    // checking a large CSV at startup stays well below the cost of parsing it
+    static uint64_t checksum(const char* data, size_t size) {
+        const uint64_t prime = 1099511628211ULL;
+        uint64_t hash = 14695981039346656037ULL ^ size;
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            // Spelled out so compilers merge it into one load on little-endian
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data + i);
+            auto at = [bytes](int b) { return static_cast<uint64_t>(bytes[b]) << (8 * b); };
+            uint64_t word = at(0) | at(1) | at(2) | at(3) | at(4) | at(5) | at(6) | at(7);
+            hash = (hash ^ word) * prime;
+            hash ^= hash >> 29;
         }
-        
-        std::cout << "\n=== SELECT CATEGORY ===\n";
-        std::vector<std::string> categoryList(categories.begin(), categories.end());
-        
-        for (size_t i = 0; i < categoryList.size(); ++i) {
-            std::cout << (i + 1) << ". " << categoryList[i] << "\n";
+        for (; i < size; i++) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * prime;
+        }
+        return hash;
+    }
+    
+    // Checksum of the CSV, or 0 if it does not exist. The journal header
+    // and the snapshot manifest record this, so neither is applied to a
+    // different CSV, even one of the same size.
+    uint64_t csvChecksum() const {
+        MappedFile file(csvFile);
+        if (!file.isOpen()) return 0;
+        std::string_view contents = file.view();
+        return checksum(contents.data(), contents.size());
+    }
+    
+    // Caller holds storeMutex
+    void appendJournal(const std::string& record) {
+        if (!journal.is_open()) {
+            journal.open(journalFile, std::ios::app | std::ios::binary);
+            if (!journal.is_open()) {
+                std::cout << "Error: Could not open journal '" << journalFile << "', saving full CSV\n";
+                dirty = true;
+                requestSave();
+                return;
+            }
+            if (journalBytes == 0) {
+                journalBase = csvChecksum();
+                std::string header = "#journal," + std::to_string(journalBase) + "\n";
+                journal << header;
+                journalHeaderBytes = journalBytes = header.size();
+            }
         }
         
-        std::cout << "Choose category: ";
-        int choice;
-        std::cin >> choice;
+        journal << record << "\n";
+        journal.flush();
+        journalEntries++;
+        journalBytes += record.size() + 1;
+        Metrics::add(Metrics::BytesWritten, record.size() + 1);
         
-        if (choice < 1 || choice > (int)categoryList.size()) {
-            std::cout << "Invalid choice.\n";
-            return;
+        size_t threshold = expenses.size() / 4;
+        if (threshold < MIN_JOURNAL_COMPACTION) threshold = MIN_JOURNAL_COMPACTION;
+        if (journalEntries >= threshold) {
+            requestSave();
         }
+    }
+    
+    // Headers are "#journal,<csv bytes>", or, while a compaction is being
+    // installed, "#journal,<new csv bytes>,<old csv bytes>,<records in new csv>"
+    // so the journal stays valid whichever CSV a crash leaves behind.
+    void replayJournal() {
+        if (journal.is_open()) journal.close();
+        journalEntries = 0;
+        journalBytes = journalHeaderBytes = 0;
         
-        std::string selectedCategory = categoryList[choice - 1];
+        std::ifstream file(journalFile, std::ios::binary);
+        if (!file.is_open()) return;
+        std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        file.close();
         
-        std::vector<const Expense*> categoryExpenses;
-        for (const auto& expense : expenses) {
-            if (expense.getCategory() == selectedCategory) {
-                categoryExpenses.push_back(&expense);
+        // A crash mid-append can leave the last record without its newline.
+        // Drop it and rewrite the journal, so the next append does not run
+        // on from the fragment.
+        size_t end = text.rfind('\n');
+        end = (end == std::string::npos) ? 0 : end + 1;
+        if (end < text.size()) {
+            std::cout << "Dropping incomplete last record from journal '" << journalFile << "'\n";
+            text.resize(end);
+            std::string tempFile = journalFile + ".tmp";
+            std::ofstream out(tempFile, std::ios::binary);
+            out << text;
+            out.close();
+            if (!out || std::rename(tempFile.c_str(), journalFile.c_str()) != 0) {
+                std::remove(tempFile.c_str());
             }
         }
         
-        selectAndEditFromList(categoryExpenses);
-    }
-    
-    void selectAndEditFromList(const std::vector<const Expense*>& expenseList) {
-        if (expenseList.empty()) {
-            std::cout << "No expenses to display.\n";
+        std::istringstream lines(text);
+        std::string line;
+        if (!getline(lines, line)) {
+            std::remove(journalFile.c_str());
             return;
         }
         
-        std::cout << "\n=== SELECT EXPENSE TO EDIT ===\n";
-        for (size_t i = 0; i < expenseList.size(); ++i) {
-            std::cout << (i + 1) << ". " << expenseList[i]->toString() << "\n";
+        // A header that does not parse is set aside unreplayed, with a
+        // warning, rather than stopping the tracker from starting. A
+        // recovery header "#journal,<new>,<old>,<records>" is written while
+        // a save installs a new CSV; its first records are already in <new>.
+        std::vector<std::string> header;
+        uint64_t base = 0;
+        uint64_t recoveryBase = 0;
+        size_t skip = 0;
+        try {
+            header = splitCSVLine(line);
+            if (header[0] != "#journal" || (header.size() != 2 && header.size() != 4)) {
+                throw std::runtime_error("not a journal header");
+            }
+            base = std::stoull(header[1]);
+            if (header.size() == 4) {
+                recoveryBase = std::stoull(header[2]);
+                skip = std::stoull(header[3]);
+            }
+        } catch (const std::exception&) {
+            std::string aside = journalFile + ".bad";
+            std::cout << "Warning: Journal '" << journalFile << "' has an unreadable header; moved it to '"
+                      << aside << "' without replaying it\n";
+            if (std::rename(journalFile.c_str(), aside.c_str()) != 0) std::remove(journalFile.c_str());
+            return;
         }
         
-        std::cout << "\nChoose expense to edit (1-" << expenseList.size() << "): ";
-        int choice;
-        std::cin >> choice;
-        
-        if (choice < 1 || choice > (int)expenseList.size()) {
-            std::cout << "Invalid choice.\n";
+        uint64_t csvSum = csvChecksum();
+        if (base != csvSum && (header.size() != 4 || recoveryBase != csvSum)) {
+            // Written against a different snapshot; its changes are either
+            // already in the CSV or belong to a file we no longer have.
+            std::cout << "Discarding stale journal '" << journalFile << "'\n";
+            std::remove(journalFile.c_str());
             return;
         }
+        if (base != csvSum) skip = 0;  // Recovery header over the old CSV
+        
+        journalBase = csvSum;
+        journalHeaderBytes = line.size() + 1;
+        journalBytes = journalHeaderBytes;
+        uint64_t bodyFrom = journalHeaderBytes;  // First record not already in the CSV
+        std::string kept;  // Records that apply to this CSV, for rewriting a recovery header
+        int lineNumber = 1;
+        size_t applied = 0;
+        while (getline(lines, line)) {
+            lineNumber++;
+            journalBytes += line.size() + 1;
+            Metrics::add(Metrics::BytesRead, line.size() + 1);
+            
+            if (line.empty()) continue;
+            if (skip > 0) {
+                skip--;  // Already in the CSV
+                bodyFrom = journalBytes;
+                continue;
+            }
+            
+            journalEntries++;  // Counted even if it fails, to keep offsets in step
+            try {
+                applyJournalRecord(splitCSVLine(line));
+                applied++;
+                kept += line + "\n";
+            } catch (const std::exception& e) {
+                std::cout << "Error replaying journal line " << lineNumber << ": " << e.what() << "\n";
+            }
+        }
         
-        int selectedId = expenseList[choice - 1]->getId();
-        auto it = std::find_if(expenses.begin(), expenses.end(),
-            [selectedId](const Expense& e) { return e.getId() == selectedId; });
-        
-        if (it != expenses.end()) {
-            editExpenseHelper(*it);
+        if (applied > 0) {
+            std::cout << "Replayed " << applied << " journal records from '" << journalFile << "'\n";
+            if (header.size() == 4) {
+                // Left by a crash mid-compaction; settle on the CSV we have
+                std::string plain = "#journal," + std::to_string(csvSum) + "\n";
+                std::string tempFile = journalFile + ".tmp";
+                if (writeFile(tempFile, plain + kept) &&
+                    std::rename(tempFile.c_str(), journalFile.c_str()) == 0) {
+                    journalEntries = applied;
+                    journalHeaderBytes = plain.size();
+                    journalBytes = plain.size() + kept.size();
+                } else {
+                    // Keep appending to it; the next save carries only what
+                    // follows the skipped records
+                    std::remove(tempFile.c_str());
+                    journalHeaderBytes = bodyFrom;
+                }
+            }
+        } else {
+            std::remove(journalFile.c_str());
+            journalEntries = 0;
+            journalBytes = journalHeaderBytes = 0;
         }
     }
     
-    void findAndRemoveByKeyword() {
-        std::string keyword;
-        std::cout << "Enter search keyword (category or description): ";
-        std::cin.ignore();
-        getline(std::cin, keyword);
-        
-        std::vector<const Expense*> matches;
-        for (const auto& expense : expenses) {
-            if (expense.getCategory().find(keyword) != std::string::npos ||
-                expense.getDescription().find(keyword) != std::string::npos) {
-                matches.push_back(&expense);
+    void applyJournalRecord(const std::vector<std::string>& fields) {
+        if (fields[0] == "A" && fields.size() == 6) {
+            int id = std::stoi(fields[1]);
+            if (locate(id) != ExpenseStore::npos) {
+                throw std::runtime_error("Duplicate expense ID " + fields[1]);
             }
+            Date date = parseDate(fields[2]);
+            requireYears(date.getYear(), date.getYear());
+            Expense::reserveId(id);
+            expenses.append(id, parseAmount(fields[5]), date.toPacked(),
+                            CategoryDictionary::global().intern(fields[3]), fields[4]);
+            return;
         }
         
-        if (matches.empty()) {
-            std::cout << "No expenses found containing '" << keyword << "'\n";
+        if ((fields[0] == "E" && fields.size() == 5) || (fields[0] == "R" && fields.size() == 2)) {
+            int id = std::stoi(fields[1]);
+            size_t slot = locate(id);
+            
+            if (slot == ExpenseStore::npos) {
+                throw std::runtime_error("Unknown expense ID " + fields[1]);
+            }
+            
+            if (fields[0] == "R") {
+                expenses.erase(slot);
+            } else {
+                expenses.setAmount(slot, parseAmount(fields[2]));
+                expenses.setCategory(slot, fields[3]);
+                expenses.setDescription(slot, fields[4]);
+            }
             return;
         }
         
-        selectAndRemoveFromList(matches);
+        throw std::runtime_error("Invalid journal record");
     }
     
-    void findAndRemoveRecent() {
-        std::vector<const Expense*> sortedExpenses;
-        for (const auto& expense : expenses) {
-            sortedExpenses.push_back(&expense);
-        }
-        
-        std::sort(sortedExpenses.begin(), sortedExpenses.end(),
-            [](const Expense* a, const Expense* b) { return a->getId() > b->getId(); });
-        
-        int limit = std::min(10, (int)sortedExpenses.size());
-        std::vector<const Expense*> recentExpenses(sortedExpenses.begin(), 
-                                                   sortedExpenses.begin() + limit);
+    
+    // Everything a background save writes, captured under storeMutex
+    struct PendingSave {
+        std::string csv;
+        size_t rows = 0;
+        bool wasDirty = false;
+        uint64_t csvChecksum = 0;
+        size_t journalRecords = 0;  // Journal records already folded into csv
+        uint64_t journalFrom = 0;   // Where those records start in the journal
+        uint64_t journalBytes = 0;  // Journal size when captured, 0 if none
+        std::string carried;        // Those records, copied off the lock
         
-        std::cout << "\n=== RECENT EXPENSES ===\n";
-        selectAndRemoveFromList(recentExpenses);
-    }
+        uint64_t generation = 0;  // Of the partition files written
+        std::map<int, Partition> manifest;  // Every year, resident or carried over
+        std::vector<std::pair<int, std::string>> partitionBytes;  // Resident years
+        std::map<int, std::string> residentCSV;  // Their rows, for csv
+        bool partitionsWritten = false;
+    };
     
-    void findAndRemoveByCategory() {
-        std::set<std::string> categories;
-        for (const auto& expense : expenses) {
-            categories.insert(expense.getCategory());
+    // Live slots of the resident years, in id order within each year, which
+    // is the order saves write rows in. Caller holds storeMutex.
+    std::map<int, std::vector<size_t>> residentYears() const {
+        std::map<int, std::vector<size_t>> years;
+        for (size_t slot = 0; slot < expenses.slotCount(); ++slot) {
+            if (expenses.isLive(slot)) years[ExpenseStore::yearOf(expenses.date(slot))].push_back(slot);
         }
-        
-        if (categories.empty()) {
-            std::cout << "No categories found.\n";
-            return;
+        for (auto& year : years) {
+            std::sort(year.second.begin(), year.second.end(),
+                      [this](size_t a, size_t b) { return expenses.id(a) < expenses.id(b); });
         }
+        return years;
+    }
+    
+    // Resident years get new partition files; cold years keep theirs.
+    // Caller holds storeMutex.
+    void capturePartitions(PendingSave& save, const std::map<int, std::vector<size_t>>& years) const {
+        save.generation = partitionGeneration + 1;
         
-        std::cout << "\n=== SELECT CATEGORY ===\n";
-        std::vector<std::string> categoryList(categories.begin(), categories.end());
-        
-        for (size_t i = 0; i < categoryList.size(); ++i) {
-            std::cout << (i + 1) << ". " << categoryList[i] << "\n";
+        for (const auto& year : years) {
+            Partition& partition = save.manifest[year.first];
+            partition.generation = save.generation;
+            partition.rows = year.second.size();
+            partition.minId = expenses.id(year.second.front());
+            partition.maxId = expenses.id(year.second.back());
+            partition.savedVersion = expenses.yearVersion(year.first);
+            partition.totals = expenses.yearTotals(year.first);
+            save.partitionBytes.emplace_back(year.first, snapshotBytes(year.second));
         }
         
-        std::cout << "Choose category: ";
-        int choice;
-        std::cin >> choice;
-        
-        if (choice < 1 || choice > (int)categoryList.size()) {
-            std::cout << "Invalid choice.\n";
-            return;
+        for (const auto& entry : partitions) {
+            if (!entry.second.resident) save.manifest[entry.first] = entry.second;
+        }
+    }
+    
+    // Write the new partition files and the manifest's temporary file. Runs
+    // without storeMutex; each save writes a new generation of files, so
+    // none of these are in use yet.
+    bool writePartitions(PendingSave& save) const {
+        for (auto& year : save.partitionBytes) {
+            std::memcpy(&year.second[offsetof(SnapshotHeader, csvChecksum)], &save.csvChecksum,
+                        sizeof(save.csvChecksum));
+            if (!writeFile(partitionFile(csvFile, year.first, save.generation), year.second)) return false;
+            year.second.clear();
         }
         
-        std::string selectedCategory = categoryList[choice - 1];
-        
-        std::vector<const Expense*> categoryExpenses;
-        for (const auto& expense : expenses) {
-            if (expense.getCategory() == selectedCategory) {
-                categoryExpenses.push_back(&expense);
+        std::string manifest = "#manifest," + std::to_string(save.csvChecksum) + "," +
+                               std::to_string(save.generation) + "\n";
+        const CategoryDictionary& dictionary = CategoryDictionary::global();
+        for (const auto& entry : save.manifest) {
+            const Partition& partition = entry.second;
+            manifest += std::to_string(entry.first) + "," + std::to_string(partition.generation) + "," +
+                        std::to_string(partition.rows) + "," + std::to_string(partition.minId) + "," +
+                        std::to_string(partition.maxId);
+            for (uint32_t category = 0; category < partition.totals.counts.size(); ++category) {
+                if (partition.totals.counts[category] == 0) continue;
+                manifest += ',';
+                appendCSVField(manifest, dictionary.name(category));
+                manifest += "," + std::to_string(partition.totals.amounts[category]) + "," +
+                            std::to_string(partition.totals.counts[category]);
             }
+            manifest += "\n";
         }
-        
-        selectAndRemoveFromList(categoryExpenses);
+        return writeFile(manifestFile + ".tmp", manifest);
     }
     
-    void selectAndRemoveFromList(const std::vector<const Expense*>& expenseList) {
-        if (expenseList.empty()) {
-            std::cout << "No expenses to display.\n";
+    // Caller holds storeMutex. Moves the manifest into place and deletes
+    // partition files it no longer refers to.
+    void installPartitions(const PendingSave& save) {
+        std::string tempFile = manifestFile + ".tmp";
+        if (!save.partitionsWritten || std::rename(tempFile.c_str(), manifestFile.c_str()) != 0) {
+            discardPartitions(save);  // Only costs a slower start
             return;
         }
         
-        std::cout << "\n=== SELECT EXPENSE TO REMOVE ===\n";
-        for (size_t i = 0; i < expenseList.size(); ++i) {
-            std::cout << (i + 1) << ". " << expenseList[i]->toString() << "\n";
+        // Keep what is resident now; years may have been paged in or out
+        // since. A year without a partition was resident when captured and
+        // cannot have been evicted.
+        std::map<int, Partition> installed = save.manifest;
+        for (auto& entry : installed) {
+            auto current = partitions.find(entry.first);
+            bool known = current != partitions.end();
+            entry.second.resident = !known || current->second.resident;
+            entry.second.lastUse = known ? current->second.lastUse : partitionClock;
+            if (known && entry.second.generation != save.generation) {
+                entry.second.savedVersion = current->second.savedVersion;  // File kept
+            }
         }
-        
-        std::cout << "\nChoose expense to remove (1-" << expenseList.size() << "): ";
-        int choice;
-        std::cin >> choice;
-        
-        if (choice < 1 || choice > (int)expenseList.size()) {
-            std::cout << "Invalid choice.\n";
-            return;
+        partitions.swap(installed);
+        partitionGeneration = save.generation;
+        if (!partitions.empty()) hotYear = std::max(hotYear, partitions.rbegin()->first);
+        removeStalePartitionFiles(csvFile, partitions);
+    }
+    
+    // Delete what a save wrote for a manifest that was not installed: the
+    // temporary manifest and the new generation's partition files. Every
+    // save's generation is past the installed one, so no file in use goes.
+    void discardPartitions(const PendingSave& save) const {
+        std::remove((manifestFile + ".tmp").c_str());
+        for (const auto& entry : save.manifest) {
+            if (entry.second.generation != save.generation) continue;
+            std::remove(partitionFile(csvFile, entry.first, save.generation).c_str());
         }
+    }
+    
+    // Delete csv's partition files other than those in keep, including ones
+    // left by interrupted saves and the single snapshot of older versions
+    static void removeStalePartitionFiles(const std::string& csv, const std::map<int, Partition>& keep) {
+        std::filesystem::path path(csv);
+        std::filesystem::path directory = path.has_parent_path() ? path.parent_path() : ".";
+        std::string prefix = path.filename().string() + ".";
+        std::string suffix = ".snapshot";
         
-        int selectedId = expenseList[choice - 1]->getId();
-        
-        std::cout << "\nAre you sure you want to remove this expense? (y/n): ";
-        char confirm;
-        std::cin >> confirm;
+        std::set<std::string> used;
+        for (const auto& entry : keep) {
+            used.insert(std::filesystem::path(partitionFile(csv, entry.first, entry.second.generation)).filename().string());
+        }
         
-        if (confirm == 'y' || confirm == 'Y') {
-            removeExpenseById(selectedId);
-        } else {
-            std::cout << "Removal cancelled.\n";
+        std::error_code ec;
+        std::vector<std::filesystem::path> stale;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+            std::string name = entry.path().filename().string();
+            if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+                name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+                continue;
+            }
+            std::string middle = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+            if (middle.find_first_not_of("0123456789-") == std::string::npos && !used.count(name)) {
+                stale.push_back(entry.path());
+            }
         }
+        for (const auto& file : stale) std::filesystem::remove(file, ec);
+        std::remove((csv + suffix).c_str());
     }
     
-    Expense parseCSVLine(const std::string& line) {
-        std::vector<std::string> fields;
-        std::string field;
-        bool inQuotes = false;
+    // Ask the writer thread for a save; caller holds storeMutex
+    void requestSave() {
+        saveRequests++;
+        writerWake.notify_all();
+    }
+    
+    // Save now and wait for it. Must not be called with storeMutex held.
+    bool saveToCSV() {
+        std::unique_lock<std::shared_mutex> lock(storeMutex);
+        uint64_t request = ++saveRequests;
+        saveWaiters++;
+        writerWake.notify_all();
+        writerDone.wait(lock, [&] { return savesDone >= request; });
+        saveWaiters--;
         
-        for (size_t i = 0; i < line.length(); ++i) {
-            char c = line[i];
+        if (lastSaveOk) {
+            std::cout << "Saved " << lastSavedRows << " expenses to '" << csvFile << "'\n";
+        }
+        return lastSaveOk;
+    }
+    
+    // Waits out any save in progress; for callers about to replace the store
+    std::unique_lock<std::shared_mutex> lockWhenIdle() {
+        std::unique_lock<std::shared_mutex> lock(storeMutex);
+        writerDone.wait(lock, [this] { return !saving; });
+        return lock;
+    }
+    
+    // Background writer. Saves are serialized under storeMutex and written
+    // to temporary files without it, so mutations only wait for the CPU
+    // side. Requests that arrive while a save runs, or within
+    // SAVE_INTERVAL of it, are folded into the next one.
+    void writerLoop() {
+        std::unique_lock<std::shared_mutex> lock(storeMutex);
+        while (true) {
+            writerWake.wait(lock, [this] { return saveRequests > savesDone || stopWriter; });
+            if (saveRequests == savesDone) break;
             
-            if (c == '"') {
-                inQuotes = !inQuotes;
-            } else if (c == ',' && !inQuotes) {
-                fields.push_back(field);
-                field.clear();
-            } else {
-                field += c;
+            uint64_t covered = saveRequests;
+            PendingSave save = captureSave();
+            saving = true;
+            lock.unlock();
+            
+            bool ok = writeSaveFiles(save);
+            
+            lock.lock();
+            ok = ok && installSave(save);
+            if (!ok) {
+                discardPartitions(save);
+                dirty = dirty || save.wasDirty;
+                std::cout << "Error: Could not save to '" << csvFile << "'\n";
             }
+            saving = false;
+            lastSaveOk = ok;
+            lastSavedRows = save.rows;
+            savesDone = covered;
+            writerDone.notify_all();
+            
+            writerWake.wait_for(lock, SAVE_INTERVAL, [this] { return stopWriter || saveWaiters > 0; });
         }
-        fields.push_back(field);
-        
-        if (fields.size() < 4) {
-            throw std::runtime_error("Invalid CSV format");
-        }
-        
-        Date date = parseDate(fields[0]);
-        std::string category = fields[1];
-        std::string description = fields[2];
-        double amount = std::stod(fields[3]);
-        
-        return Expense(amount, category, description, date);
     }
     
-    Date parseDate(const std::string& dateStr) {
-        std::vector<int> parts;
-        std::stringstream ss(dateStr);
-        std::string part;
+    PendingSave captureSave() {
+        PendingSave save;
+        std::map<int, std::vector<size_t>> years = residentYears();
+        for (const auto& year : years) save.residentCSV[year.first] = csvRows(year.second);
+        capturePartitions(save, years);
+        save.rows = ledgerSize();
+        save.wasDirty = dirty;
+        dirty = false;
+        save.journalRecords = journalEntries;
+        save.journalFrom = journalHeaderBytes;
+        save.journalBytes = journalBytes;
+        return save;
+    }
+    
+    // Runs without storeMutex. The journal prefix is append-only, so it can
+    // be copied while new records are added behind it.
+    bool writeSaveFiles(PendingSave& save) {
+        Metrics::Timer timer(Metrics::Save);
         
-        while (getline(ss, part, '-')) {
-            parts.push_back(std::stoi(part));
+        // Rows go out year by year and in id order within a year, so the
+        // CSV reads the same whichever years are in memory. Years that are
+        // not are copied from their partition files.
+        save.csv = "Id,Date,Category,Description,Amount\n";
+        for (const auto& entry : save.manifest) {
+            if (entry.second.generation == save.generation) {
+                std::string& rows = save.residentCSV[entry.first];
+                save.csv += rows;
+                std::string().swap(rows);
+            } else if (!appendPartitionCSV(partitionFile(csvFile, entry.first, entry.second.generation), save.csv)) {
+                return false;
+            }
         }
+        save.csvChecksum = checksum(save.csv.data(), save.csv.size());
         
-        if (parts.size() != 3) {
-            throw std::runtime_error("Invalid date format");
+        // Write to temporary files and rename them into place later so a
+        // crash mid-save never leaves a truncated ledger behind
+        if (!writeFile(csvFile + ".tmp", save.csv)) {
+            std::remove((csvFile + ".tmp").c_str());
+            return false;
         }
+        save.csv.clear();
+        save.partitionsWritten = writePartitions(save);
         
-        return Date(parts[0], parts[1], parts[2]);
+        if (save.journalBytes > 0 &&
+            !readFileRange(journalFile, save.journalFrom, save.journalBytes, save.carried)) {
+            std::remove((csvFile + ".tmp").c_str());
+            return false;
+        }
+        return true;
     }
     
-    void loadFromCSV() {
-        expenses.clear();
+    // Caller holds storeMutex. Swaps the new files in so that a crash at
+    // any point leaves a CSV and journal that replay to the same ledger.
+    bool installSave(const PendingSave& save) {
+        std::string csvTemp = csvFile + ".tmp";
+        std::string journalTemp = journalFile + ".tmp";
+        if (journal.is_open()) journal.close();
         
-        std::ifstream file(csvFile);
-        if (!file.is_open()) {
-            std::cout << "CSV file '" << csvFile << "' not found. Starting with empty expense list.\n";
-            return;
+        std::string tail;  // Records added since the save was captured
+        uint64_t tailFrom = save.journalBytes > 0 ? save.journalBytes : journalHeaderBytes;
+        if (journalBytes > 0 && !readFileRange(journalFile, tailFrom, journalBytes, tail)) {
+            std::remove(csvTemp.c_str());
+            return false;
         }
         
-        std::string line;
-        int lineNumber = 0;
-        
-        // Skip header line if it exists
-        if (getline(file, line)) {
-            lineNumber++;
-            // Check if first line is a header
-            if (line.find("Date,Category,Description,Amount") != std::string::npos ||
-                line.find("date,category,description,amount") != std::string::npos) {
-                // It's a header, skip it
-                std::cout << "Found CSV header, loading data...\n";
-            } else {
-                // First line is data, parse it
-                try {
-                    Expense expense = parseCSVLine(line);
-                    if (expense.getAmount() > 0) {
-                        expenses.push_back(expense);
-                    }
-                } catch (const std::exception& e) {
-                    std::cout << "Error parsing first line: " << e.what() << "\n";
-                }
+        // First a journal that replays correctly over either CSV
+        uint64_t newChecksum = save.csvChecksum;
+        std::string recoveryHeader = "#journal," + std::to_string(newChecksum) + "," +
+                                     std::to_string(journalBase) + "," + std::to_string(save.journalRecords) + "\n";
+        if (journalBytes > 0) {
+            if (!writeFile(journalTemp, recoveryHeader + save.carried + tail) ||
+                std::rename(journalTemp.c_str(), journalFile.c_str()) != 0) {
+                std::remove(journalTemp.c_str());
+                std::remove(csvTemp.c_str());
+                return false;
             }
         }
         
-        // Parse remaining lines
-        while (getline(file, line)) {
-            lineNumber++;
-            
-            if (line.empty()) continue;
-            
-            try {
-                Expense expense = parseCSVLine(line);
-                if (expense.getAmount() > 0) {
-                    expenses.push_back(expense);
-                }
-            } catch (const std::exception& e) {
-                std::cout << "Error parsing line " << lineNumber << ": " << e.what() << "\n";
+        if (std::rename(csvTemp.c_str(), csvFile.c_str()) != 0) {
+            std::remove(csvTemp.c_str());
+            return false;  // The journal still replays over the old CSV
+        }
+        installPartitions(save);
+        
+        // Then trim the journal down to the records the new CSV lacks
+        journalEntries -= save.journalRecords;
+        if (journalBytes > 0 && journalEntries > 0) {
+            std::string header = "#journal," + std::to_string(newChecksum) + "\n";
+            if (writeFile(journalTemp, header + tail) &&
+                std::rename(journalTemp.c_str(), journalFile.c_str()) == 0) {
+                journalBase = newChecksum;
+                journalHeaderBytes = header.size();
+                journalBytes = header.size() + tail.size();
+                return true;
             }
+            // Keep appending to the recovery journal, which is still valid;
+            // the next save carries only what follows the folded records
+            std::remove(journalTemp.c_str());
+            journalBase = newChecksum;
+            journalHeaderBytes = recoveryHeader.size() + save.carried.size();
+            journalBytes = journalHeaderBytes + tail.size();
+            return true;
         }
         
-        file.close();
-        std::cout << "Loaded " << expenses.size() << " expenses from '" << csvFile << "'\n";
+        std::remove(journalFile.c_str());
+        journalEntries = 0;
+        journalBytes = journalHeaderBytes = 0;
+        return true;
     }
     
-    void saveToCSV() const {
-        std::ofstream file(csvFile);
-        if (!file.is_open()) {
-            std::cout << "Error: Could not save to '" << csvFile << "'\n";
-            return;
-        }
-        
-        // Write header
-        file << "Date,Category,Description,Amount\n";
-        
-        // Write expenses in CSV format (DD-MM-YYYY)
-        for (const auto& expense : expenses) {
-            file << formatDateForCSV(expense.getDate()) << ","
-                 << expense.getCategory() << ","
-                 << expense.getDescription() << ","
-                 << std::fixed << std::setprecision(2) << expense.getAmount() << "\n";
-        }
-        
-        file.close();
-        std::cout << "Saved " << expenses.size() << " expenses to '" << csvFile << "'\n";
+    static std::string formatDateForCSV(const Date& date) {
+        std::string text;
+        appendDate(text, date.toPacked());
+        return text;
     }
     
-    std::string formatDateForCSV(const Date& date) const {
-        std::stringstream ss;
-        ss << std::setfill('0') << std::setw(2) << date.getDay() << "-"
-           << std::setfill('0') << std::setw(2) << date.getMonth() << "-"
-           << date.getYear();
-        return ss.str();
+    // Append a packed date as DD-MM-YYYY
+    static void appendDate(std::string& text, uint32_t date) {
+        uint32_t day = date & 31;
+        uint32_t month = (date >> 5) & 15;
+        char buffer[16] = {static_cast<char>('0' + day / 10), static_cast<char>('0' + day % 10), '-',
+                           static_cast<char>('0' + month / 10), static_cast<char>('0' + month % 10), '-'};
+        auto end = std::to_chars(buffer + 6, buffer + sizeof(buffer), date >> 9).ptr;
+        text.append(buffer, end);
     }
     
 };
@@ -848,11 +5808,389 @@ void displayMenu() {
     std::cout << "7. Monthly Report\n";
     std::cout << "8. Top Spending Categories\n";
     std::cout << "9. Import from Another CSV\n";
-    std::cout << "10. Exit\n";
+    std::cout << "10. Date Range Report\n";
+    std::cout << "11. Show Statistics\n";
+    std::cout << "12. Manage Budgets\n";
+    std::cout << "13. Export Expenses\n";
+    std::cout << "14. Exit\n";
     std::cout << "Choose an option: ";
 }
 
-int main() {
+// Batch mode writes JSON results to stdout. The tracker's own messages are
+// sent to stderr so the output stays machine-readable.
+int runBatchMode(const std::string& commandFile) {
+    std::ios::sync_with_stdio(false);
+    
+    std::ifstream file;
+    if (commandFile != "-") {
+        file.open(commandFile);
+        if (!file.is_open()) {
+            std::cerr << "Error: Could not open command file '" << commandFile << "'\n";
+            return 1;
+        }
+    }
+    
+    std::streambuf* stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+    std::ostream results(stdoutBuffer);
+    int status;
+    {
+        ExpenseTracker tracker;
+        status = tracker.runBatch(commandFile == "-" ? std::cin : file, results);
+    }
+    results.flush();
+    std::cout.rdbuf(stdoutBuffer);
+    return status;
+}
+
+#ifdef EXPENSE_TRACKER_HAS_UNIX_SOCKETS
+// Set from SIGINT and SIGTERM to shut the server down. Workers read it
+// too, so it is a lock-free atomic rather than a plain sig_atomic_t.
+static std::atomic<bool> serverStopRequested{false};
+
+extern "C" void requestServerStop(int) { serverStopRequested.store(true); }
+
+// Whether something accepts connections on the Unix socket at path
+bool serverListening(const std::string& path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+    bool listening = ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    ::close(fd);
+    return listening;
+}
+
+bool writeAll(int fd, const std::string& bytes) {
+    size_t written = 0;
+    while (written < bytes.size()) {
+        ssize_t n = ::write(fd, bytes.data() + written, bytes.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        written += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Serves the batch command language over a Unix domain socket, one JSON
+// reply line per command line. The accept loop hands connections to a
+// fixed pool of workers, each serving one connection at a time; locking is
+// up to ExpenseTracker::serveCommand. A connection arriving while every
+// worker is taken gets an error reply and is closed rather than left
+// waiting behind clients that may stay idle indefinitely.
+class LedgerServer {
+private:
+    ExpenseTracker& tracker;
+    std::string path;
+    std::vector<std::thread> workers;
+    std::deque<int> connections;  // Accepted, waiting for a worker
+    size_t busyWorkers = 0;
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    bool stopping = false;
+    
+    // How often threads blocked on a socket check for shutdown
+    static const int POLL_MS = 200;
+    // A client sending a longer line is disconnected
+    static const size_t MAX_LINE = 1 << 20;
+    
+    void workerLoop() {
+        ExpenseStore::aggregateSerially(true);  // The workers already fill the cores
+        while (true) {
+            int fd;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueReady.wait(lock, [this] { return stopping || !connections.empty(); });
+                if (stopping) return;
+                fd = connections.front();
+                connections.pop_front();
+                busyWorkers++;
+            }
+            serveConnection(fd);
+            ::close(fd);
+            std::lock_guard<std::mutex> lock(queueMutex);
+            busyWorkers--;
+        }
+    }
+    
+    void serveConnection(int fd) {
+        std::string pending;
+        char buffer[64 * 1024];
+        bool open = true;
+        while (open && !serverStopRequested) {
+            pollfd client{fd, POLLIN, 0};
+            int ready = ::poll(&client, 1, POLL_MS);
+            if (ready < 0 && errno != EINTR) return;
+            if (ready <= 0) continue;
+            
+            ssize_t n = ::read(fd, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR) continue;
+            if (n > 0) {
+                pending.append(buffer, static_cast<size_t>(n));
+            } else {
+                // The client is done; a last line may lack its newline
+                open = false;
+                if (!pending.empty()) pending += '\n';
+            }
+            
+            std::ostringstream replies;
+            size_t start = 0;
+            size_t end;
+            while ((end = pending.find('\n', start)) != std::string::npos) {
+                std::string line = pending.substr(start, end - start);
+                start = end + 1;
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.empty() || line[0] == '#') continue;
+                tracker.serveCommand(line, replies);
+            }
+            pending.erase(0, start);
+            if (!writeAll(fd, replies.str())) return;
+            if (pending.size() > MAX_LINE) {
+                writeAll(fd, "{\"op\":\"\",\"ok\":false,\"error\":\"Line too long\"}\n");
+                return;
+            }
+        }
+    }
+
+public:
+    LedgerServer(ExpenseTracker& ledger, const std::string& socketPath) : tracker(ledger), path(socketPath) {}
+    
+    // Serve until SIGINT or SIGTERM. Returns the process exit status.
+    int run() {
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Error: Socket path '" << path << "' is too long\n";
+            return 1;
+        }
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        
+        // A socket file left behind by a server that died is replaced
+        if (serverListening(path)) {
+            std::cerr << "Error: A server is already listening on '" << path << "'\n";
+            return 1;
+        }
+        ::unlink(path.c_str());
+        
+        int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            ::listen(listener, SOMAXCONN) != 0) {
+            std::cerr << "Error: Could not listen on '" << path << "': " << std::strerror(errno) << "\n";
+            if (listener >= 0) ::close(listener);
+            return 1;
+        }
+        
+        std::signal(SIGINT, requestServerStop);
+        std::signal(SIGTERM, requestServerStop);
+        std::signal(SIGPIPE, SIG_IGN);  // A client hanging up fails the write instead
+        
+        unsigned threads = std::max(4u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < threads; ++i) {
+            workers.emplace_back(&LedgerServer::workerLoop, this);
+        }
+        std::cerr << "Listening on '" << path << "' with " << threads << " workers\n";
+        
+        while (!serverStopRequested) {
+            pollfd listening{listener, POLLIN, 0};
+            if (::poll(&listening, 1, POLL_MS) <= 0) continue;
+            int fd = ::accept(listener, nullptr, nullptr);
+            if (fd < 0) continue;
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                if (busyWorkers + connections.size() < workers.size()) {
+                    connections.push_back(fd);
+                    fd = -1;
+                }
+            }
+            if (fd >= 0) {
+                writeAll(fd, "{\"op\":\"\",\"ok\":false,\"error\":\"Server busy: all " +
+                                 std::to_string(workers.size()) + " workers are serving other clients\"}\n");
+                ::close(fd);
+                continue;
+            }
+            queueReady.notify_one();
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueReady.notify_all();
+        for (std::thread& worker : workers) worker.join();
+        for (int fd : connections) ::close(fd);
+        ::close(listener);
+        ::unlink(path.c_str());
+        std::cerr << "Server stopped\n";
+        return 0;
+    }
+};
+
+int runServerMode(const std::string& socketPath) {
+    std::streambuf* stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+    int status;
+    {
+        ExpenseTracker tracker;
+        status = LedgerServer(tracker, socketPath).run();
+    }
+    std::cout.rdbuf(stdoutBuffer);
+    return status;
+}
+
+// Thin client: send each command line to the server and print its reply.
+// Returns 1 if the server cannot be reached or any command fails.
+int runClientMode(const std::string& socketPath, const std::string& commandFile) {
+    std::ifstream file;
+    if (commandFile != "-") {
+        file.open(commandFile);
+        if (!file.is_open()) {
+            std::cerr << "Error: Could not open command file '" << commandFile << "'\n";
+            return 1;
+        }
+    }
+    std::istream& in = commandFile == "-" ? std::cin : file;
+    
+    sockaddr_un address{};
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socketPath.size() >= sizeof(address.sun_path) || fd < 0) {
+        std::cerr << "Error: Could not connect to '" << socketPath << "'\n";
+        if (fd >= 0) ::close(fd);
+        return 1;
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        std::cerr << "Error: Could not connect to '" << socketPath << "': " << std::strerror(errno) << "\n";
+        ::close(fd);
+        return 1;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+    
+    // One command at a time: send a line, then read its reply line
+    int status = 0;
+    std::string line;
+    std::string received;
+    char buffer[64 * 1024];
+    while (getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        // A server that turned the connection away has already replied
+        // with its error, so read that even if the send fails
+        bool sent = writeAll(fd, line + "\n");
+        
+        size_t end;
+        while ((end = received.find('\n')) == std::string::npos) {
+            ssize_t n = ::read(fd, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            received.append(buffer, static_cast<size_t>(n));
+        }
+        if (end == std::string::npos) {
+            std::cerr << "Error: Lost connection to '" << socketPath << "'\n";
+            status = 1;
+            break;
+        }
+        
+        std::string reply = received.substr(0, end + 1);
+        received.erase(0, end + 1);
+        std::cout << reply << std::flush;
+        if (reply.find("\"ok\":false") != std::string::npos) status = 1;
+        if (!sent) {
+            status = 1;
+            break;
+        }
+    }
+    ::close(fd);
+    return status;
+}
+#endif
+
+// Define EXPENSE_TRACKER_NO_MAIN to reuse the tracker from another program,
+// such as amount_test.cpp or benchmark.cpp
+#ifndef EXPENSE_TRACKER_NO_MAIN
+// Prints and exports the statistics once everything, including the final
+// save in ~ExpenseTracker, has been measured
+struct StatisticsOnExit {
+    std::ostream* report = nullptr;
+    
+    ~StatisticsOnExit() {
+        if (report) Metrics::printReport(*report);
+        Metrics::exportNow();
+    }
+};
+
+int main(int argc, char* argv[]) {
+    // expense_tracker [--stats] [--stats-export <file>] [--batch [commands-file|-]]
+    //                 [--serve [socket] | --connect [socket]]
+    StatisticsOnExit statistics;
+    bool batch = false;
+    bool serve = false;
+    bool connect = false;
+    std::string commandFile = "-";
+    std::string socketPath = ExpenseTracker::socketFile(ExpenseTracker::DEFAULT_CSV);
+    for (int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        if (option == "--serve" || option == "--connect") {
+            (option == "--serve" ? serve : connect) = true;
+            if (i + 1 < argc && std::string(argv[i + 1]).rfind("--", 0) != 0) socketPath = argv[++i];
+        } else if (option == "--stats") {
+            Metrics::enable();
+            statistics.report = &std::cout;
+        } else if (option == "--stats-export" && i + 1 < argc) {
+            Metrics::exportTo(argv[++i]);
+        } else if (option == "--batch") {
+            batch = true;
+            if (i + 1 < argc && std::string(argv[i + 1]).rfind("--", 0) != 0) commandFile = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--stats] [--stats-export <file>] [--batch [commands-file|-]]\n"
+                      << "       [--serve [socket] | --connect [socket]]\n";
+            return 1;
+        }
+    }
+    
+#ifdef EXPENSE_TRACKER_HAS_UNIX_SOCKETS
+    if (connect) return runClientMode(socketPath, commandFile);
+#else
+    if (serve || connect) {
+        std::cerr << "Error: --serve and --connect need Unix domain sockets\n";
+        return 1;
+    }
+#endif
+    
+    // Whichever process has the ledger open holds its lock until it exits.
+    // While a server holds it, scripts go through the server; nothing else
+    // starts, since it would save over the owner's changes.
+    LedgerLock ledgerLock(ExpenseTracker::DEFAULT_CSV);
+    if (!ledgerLock.held()) {
+#ifdef EXPENSE_TRACKER_HAS_UNIX_SOCKETS
+        bool serverRunning = serverListening(socketPath);
+        if (batch && !serve && serverRunning) {
+            std::cerr << "Sending commands to the server on '" << socketPath << "'\n";
+            return runClientMode(socketPath, commandFile);
+        }
+        if (serverRunning && !serve) {
+            std::cerr << "Error: A server is running on '" << socketPath << "'; use --connect to send it commands\n";
+            return 1;
+        }
+#endif
+        std::cerr << "Error: " << ledgerLock.error() << "\n";
+        return 1;
+    }
+
+#ifdef EXPENSE_TRACKER_HAS_UNIX_SOCKETS
+    if (serve) {
+        if (statistics.report) statistics.report = &std::cerr;
+        return runServerMode(socketPath);
+    }
+#endif
+    
+    if (batch) {
+        // Keep stdout for the JSON results
+        if (statistics.report) statistics.report = &std::cerr;
+        return runBatchMode(commandFile);
+    }
+    
     ExpenseTracker tracker;
     int choice;
     
@@ -870,11 +6208,16 @@ int main() {
         
         switch (choice) {
             case 1: {
-                double amount;
-                std::string category, description;
+                std::string amountText, category, description;
+                int64_t amount = 0;
                 
                 std::cout << "Enter amount: ";
-                std::cin >> amount;
+                std::cin >> amountText;
+                if (!Money::parse(amountText, amount)) {
+                    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+                    std::cout << "Invalid amount.\n";
+                    break;
+                }
                 
                 std::cout << "Enter category: ";
                 std::cin.ignore();
@@ -939,7 +6282,33 @@ int main() {
                 break;
             }
             
-            case 10:
+            case 10: {
+                std::string from, to;
+                std::cout << "Enter start date (DD-MM-YYYY): ";
+                std::cin >> from;
+                std::cout << "Enter end date (DD-MM-YYYY): ";
+                std::cin >> to;
+                tracker.viewDateRange(from, to);
+                break;
+            }
+            
+            case 11:
+                if (Metrics::enabled()) {
+                    Metrics::printReport(std::cout);
+                } else {
+                    std::cout << "Statistics are off. Start the tracker with --stats to collect them.\n";
+                }
+                break;
+                
+            case 12:
+                tracker.manageBudgets();
+                break;
+                
+            case 13:
+                tracker.exportExpenses();
+                break;
+                
+            case 14:
                 std::cout << "Thank you for using Personal Expense Tracker!\n";
                 return 0;
                 
@@ -950,4 +6319,5 @@ int main() {
     }
     
     return 0;
-}
\ No newline at end of file
+}
+#endif
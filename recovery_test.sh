@@ -0,0 +1,117 @@
+#!/bin/sh
+# Crash-recovery checks for the mutation journal.
+#
+# Builds final.cpp and runs the tracker against scratch ledgers:
+#   - killed between a journal append and the save that folds it in
+#   - a journal whose last record was torn by a crash mid-write
+#   - a stale journal, left behind after the CSV was replaced
+#   - a journal whose header does not parse
+#
+# Usage: sh recovery_test.sh [extra compiler flags...]
+
+ROOT=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+${CXX:-g++} -std=c++17 -O2 -pthread "$@" -o "$WORK/tracker" "$ROOT/final.cpp" || exit 1
+EXIT_CHOICE=$(grep -o '"[0-9]*\. Exit' "$ROOT/final.cpp" | tr -dc '0-9')
+LEDGER="$WORK/ledger"
+JOURNAL="$LEDGER/expenses.csv.journal"
+failures=0
+
+check() {
+    name=$1
+    shift
+    if "$@"; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name"
+        failures=$((failures + 1))
+    fi
+}
+
+has() {
+    grep -q -- "$2" "$1"
+}
+
+lacks() {
+    ! grep -q -- "$2" "$1"
+}
+
+new_ledger() {
+    rm -rf "$LEDGER"
+    mkdir "$LEDGER"
+    printf 'Date,Category,Description,Amount\n01-02-2024,Food,Lunch,12.50\n03-02-2024,Bills,Phone,30.00\n' \
+        > "$LEDGER/expenses.csv"
+}
+
+# Run the tracker on the scratch ledger with the given menu input
+run() {
+    (cd "$LEDGER" && printf "$1" | timeout 60 "$WORK/tracker" > "$WORK/out.txt" 2>&1)
+}
+
+# Add an expense through the menu, then kill -9 the tracker as soon as the
+# record reaches the journal, before anything folds it into the CSV
+crash_add() {
+    rm -f "$WORK/in"
+    mkfifo "$WORK/in"
+    (cd "$LEDGER" && exec "$WORK/tracker" < "$WORK/in" > "$WORK/crash.txt" 2>&1) &
+    pid=$!
+    exec 3> "$WORK/in"
+    printf '1\n7.25\nCrash\n%s\n' "$1" >&3
+    tries=0
+    while ! grep -q -- "$1" "$JOURNAL" 2> /dev/null && [ $tries -lt 100 ]; do
+        sleep 0.1
+        tries=$((tries + 1))
+    done
+    kill -9 $pid 2> /dev/null
+    wait $pid 2> /dev/null
+    exec 3>&-
+}
+
+# Killed between the journal append and the save
+new_ledger
+crash_add "killed before save"
+check "journal holds the record" has "$JOURNAL" "killed before save"
+check "CSV not yet rewritten" lacks "$LEDGER/expenses.csv" "killed before save"
+run "2\n$EXIT_CHOICE\n"
+check "record replayed on restart" has "$WORK/out.txt" "killed before save"
+check "record saved on exit" has "$LEDGER/expenses.csv" "killed before save"
+check "journal folded into CSV" test ! -e "$JOURNAL"
+
+# Torn last line: the complete record before it still replays, and records
+# appended afterwards do not run on from the fragment
+new_ledger
+crash_add "before the tear"
+printf 'A,99,04-02-2024,Torn,half a rec' >> "$JOURNAL"
+crash_add "after the tear"
+run "2\n$EXIT_CHOICE\n"
+check "torn record dropped" lacks "$WORK/out.txt" "half a rec"
+check "record before tear replayed" has "$WORK/out.txt" "before the tear"
+check "record after tear replayed" has "$WORK/out.txt" "after the tear"
+check "both records saved" sh -c "grep -q 'before the tear' '$LEDGER/expenses.csv' && grep -q 'after the tear' '$LEDGER/expenses.csv'"
+
+# Stale journal: the CSV was replaced by a file of the same size after the
+# journal was written, so the journal must not be replayed over it
+new_ledger
+crash_add "stale record"
+sed 's/Lunch/Lunce/' "$LEDGER/expenses.csv" > "$WORK/replaced.csv"
+mv "$WORK/replaced.csv" "$LEDGER/expenses.csv"
+run "2\n$EXIT_CHOICE\n"
+check "stale journal discarded" has "$WORK/out.txt" "Discarding stale journal"
+check "stale record not replayed" lacks "$WORK/out.txt" "stale record"
+check "replaced CSV kept" has "$LEDGER/expenses.csv" "Lunce"
+
+# Unparseable header: startup carries on and the journal is set aside
+new_ledger
+printf '#journal,not-a-checksum\nA,3,04-02-2024,Bad,bad header,1.00\n' > "$JOURNAL"
+run "2\n$EXIT_CHOICE\n"
+check "tracker starts past a bad header" has "$WORK/out.txt" "Lunch"
+check "bad journal not replayed" lacks "$WORK/out.txt" "bad header"
+check "bad journal moved aside" test -e "$JOURNAL.bad"
+
+if [ $failures -ne 0 ]; then
+    echo "$failures recovery check(s) failed"
+    exit 1
+fi
+echo "All recovery checks passed"